@@ -19,15 +19,35 @@
 
 #include "address.h"
 
+void Address::set(const void *data, int size) {
+	this->size = size < 0 ? 0 : size > (int)MaxSize ? (int)MaxSize : size;
+	if (this->size) memcpy(this->data, data, this->size);
+}
+
 bool Address::operator< (const Address &other) const {
-	if (data.size() < other.data.size()) return true;
-	if (other.data.size() < data.size()) return false;
-	if (data.empty()) return false;
-	return memcmp(&data.front(), &other.data.front(), data.size()) < 0;
+	if (size != other.size) return size < other.size;
+	return size > 0 && memcmp(data, other.data, size) < 0;
 }
 
 bool Address::operator== (const Address &other) const {
-	if (data.size() != other.data.size()) return false;
-	if (data.empty()) return true;
-	return memcmp(&data.front(), &other.data.front(), data.size()) == 0;
+	return size == other.size && (size <= 0 || memcmp(data, other.data, size) == 0);
+}
+
+size_t Address::hash() const {
+	// multiply-xorshift over 8-byte words, ipv4 address takes two rounds
+	unsigned long long h = 0x9E3779B97F4A7C15ull*(unsigned long long)(size + 1);
+	int i = 0;
+	for(; i + 8 <= size; i += 8) {
+		unsigned long long w;
+		memcpy(&w, data + i, 8);
+		h = (h ^ w)*0xFF51AFD7ED558CCDull;
+		h ^= h >> 32;
+	}
+	if (i < size) {
+		unsigned long long w = 0;
+		memcpy(&w, data + i, size - i);
+		h = (h ^ w)*0xFF51AFD7ED558CCDull;
+		h ^= h >> 32;
+	}
+	return (size_t)h;
 }
@@ -18,17 +18,40 @@
 #ifndef _ADDRESS_H_
 #define _ADDRESS_H_
 
+#include <cstddef>
+#include <cstring>
+
 #include <string>
-#include <vector>
 
-struct Address {
-	std::vector<char> data;
 
-	Address() { }
-	explicit Address(const std::string &address) { fromString(address); }
+// socket address stored inline (no heap), so it is cheap to receive, copy and compare
+struct Address {
+	enum {
+		MaxSize = 128   // size of sockaddr_storage
+	};
+
+	int size;
+	union {
+		char data[MaxSize];
+		unsigned long long align;
+	};
+
+	Address(): size() { }
+	explicit Address(const std::string &address): size() { fromString(address); }
+	Address(const Address &other): size(other.size)
+		{ memcpy(data, other.data, size); }
+	Address& operator= (const Address &other)
+		{ size = other.size; memcpy(data, other.data, size); return *this; }
+
+	bool empty() const { return size <= 0; }
+	void clear() { size = 0; }
+	void set(const void *data, int size);
 
 	bool operator< (const Address &other) const;
 	bool operator== (const Address &other) const;
+	bool operator!= (const Address &other) const { return !(*this == other); }
+	size_t hash() const;
+
 	std::string toString() const;
 	bool fromString(const std::string &address);
 };
@@ -26,6 +26,9 @@
 #include "address.h"
 #include "log.h"
 
+
+static_assert(sizeof(sockaddr_storage) <= Address::MaxSize, "address does not fit sockaddr_storage");
+
 bool Address::fromString(const std::string &address) {
 	size_t pos = address.find(":");
 	std::string host;
@@ -68,8 +71,7 @@ bool Address::fromString(const std::string &address) {
     	addr_ch[3] = (unsigned char)addr_i[3];
     }
 
-    data.resize(sizeof(addr));
-    memcpy(&data.front(), &addr, sizeof(addr));
+    set(&addr, sizeof(addr));
 
 	return true;
 }
@@ -77,7 +79,7 @@ bool Address::fromString(const std::string &address) {
 std::string Address::toString() const {
     sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
-    if (!data.empty())
-    	memcpy(&addr, &data.front(), std::min(sizeof(addr), data.size()));
+    if (!empty())
+    	memcpy(&addr, data, std::min(sizeof(addr), (size_t)size));
     return Log::strprintf("%s:%d", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
 }
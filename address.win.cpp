@@ -66,8 +66,7 @@ bool Address::fromString(const std::string &address) {
     	addr_ch[3] = (unsigned char)addr_i[3];
     }
 
-    data.resize(sizeof(addr));
-    memcpy(&data.front(), &addr, sizeof(addr));
+    set(&addr, sizeof(addr));
 
 	return true;
 }
@@ -75,7 +74,7 @@ bool Address::fromString(const std::string &address) {
 std::string Address::toString() const {
     sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
-    if (data.size() == sizeof(sockaddr_in))
-    	memcpy(&addr, &data.front(), std::min(sizeof(addr), data.size()));
+    if (size == sizeof(sockaddr_in))
+    	memcpy(&addr, data, std::min(sizeof(addr), (size_t)size));
     return Log::strprintf("%s:%d", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
 }
@@ -19,6 +19,7 @@
 #include <cmath>
 #include <cstring>
 #include <algorithm>
+#include <utility>
 
 #include "connection.h"
 
@@ -62,6 +63,9 @@ Connection::Connection(
 	Socket &tcpSocket,
 	UdpListener &udpListener,
 	const Address &udpAddress,
+	unsigned int connectionId,
+	bool connectionIdNegotiated,
+	int tcpReceiveChunkSize,
 	int udpSendPacketSize,
 	int udpMaxSentBufferSize,
 	int udpMaxReceiveBufferSize,
@@ -81,9 +85,14 @@ Connection::Connection(
 	tcpSocket(&tcpSocket),
 	udpListener(&udpListener),
 	udpAddress(udpAddress),
+	connectionId(connectionId),
+	connectionIdNegotiated(connectionIdNegotiated),
 	tcpConnected(true),
 	udpConnected(true),
+	udpWaitWrite(),
+	tcpReceiveChunkSize(tcpReceiveChunkSize),
 	udpSendPacketSize(udpSendPacketSize),
+	udpPendingSendPacketSize(),
 	udpMaxSentBufferSize(udpMaxSentBufferSize),
 	udpMaxReceiveBufferSize(udpMaxReceiveBufferSize),
 	udpMaxSentMeasureSize(udpMaxSentMeasureSize),
@@ -95,6 +104,7 @@ Connection::Connection(
 	buildUdpPacketsUs(buildUdpPacketsUs),
 	udpMaxSentMeasureUs(udpMaxSentMeasureUs),
 	tcpNextSendIndex(),
+	tcpNextSendOffset(),
 	udpNextSendIndex(),
 	udpReceivedMasterIndex(),
 	udpConfirmedMasterIndex(),
@@ -104,14 +114,24 @@ Connection::Connection(
 	udpPacketsToSendCount(),
 	remainConfirmationResendCount(),
 	remainByeByeResendCount(),
+	remoteProtocolVersion(),
+	capabilities(),
+	tcpReceivedSize(),
+	udpSentFirstUnsentIndex(),
+	udpReceivedMaxIndex(),
+	udpAddressChangeAllowedUs(),
+	udpLastReceivedUs(),
 	udpLastSentUs(),
 	udpSendIntervalUs(udpInitialSendIntervalUs),
 	udpSendIntervalUsFloat((double)udpInitialSendIntervalUs),
+	pacer(udpListener.getTcpAddress().empty() ? &server.udpPacer : &server.udpPriorityPacer),
+	pacerTimeUs(-1),
+	pacerTick(),
+	pacerIndex(),
 	udpSendMeasureIndex(),
 	eventTcpRead(*this, server.eventManager, tcpSocket.sourceRead),
 	eventTcpWrite(*this, server.eventManager, tcpSocket.sourceWrite),
 	eventTcpClose(*this, server.eventManager, tcpSocket.sourceClose),
-	eventUdpWrite(*this, server.eventManager, udpListener.getSocket().sourceWrite, udpListener.getTcpAddress().data.empty() ? 0 : 1),
 	eventUdpClose(*this, server.eventManager, udpListener.getSocket().sourceClose),
 	eventBuildUdpPackets(*this, server.eventManager),
 	eventBuildConfirmations(*this, server.eventManager),
@@ -120,22 +140,31 @@ Connection::Connection(
 	eventUdpCloseWait(*this, server.eventManager),
 	eventClose(*this, server.eventManager)
 {
-	udpSendMeasures[udpSendMeasureIndex].beginUs = Platform::nowUs();
+	udpSendMeasures.insert(udpSendMeasureIndex).beginUs = server.eventManager.getNowUs();
 	server.udpSummaryConnectionsSendIntervalUs += udpSendIntervalUs;
 
-	Packet &packet = udpSentPackets[udpNextSendIndex];
+	Packet &packet = udpSentPackets.insert(udpNextSendIndex);
+	packet.setPool(&server.packetPool);
 	packet.remainResendCount = udpResendCount;
-	packet.encode(Packet::Hello, udpNextSendIndex);
+	packet.encodeHello(
+		udpNextSendIndex,
+		Packet::Capabilities,
+		std::min(udpSendPacketSize, server.udpReceivePacketSize - (int)Packet::HeaderSize - (int)Packet::ConnectionIdSize),
+		connectionId,
+		getSendConnectionId() );
 	++udpNextSendIndex;
 
 	++udpPacketsToSendCount;
 	onUdpSentBufferChanged(packet.getSize());
-	eventUdpWrite.setTimeRelativeNow();
+	pacer->schedule(*this, server.eventManager.getNowUs());
 	eventTcpClose.setTimeRelativeNow();
 	eventUdpClose.setTimeRelativeNow();
 }
 
 Connection::~Connection() {
+	if (udpWaitWrite) udpListener->cancelWaitWrite(*this);
+	pacer->cancel(*this);
+	udpListener->cancelTransmit(*this);
 	server->udpSummaryConnectionsSendIntervalUs -= udpSendIntervalUs;
 	delete tcpSocket;
 }
@@ -150,9 +179,6 @@ void Connection::handle(Event &event, long long plannedTimeUs) {
 	if (&event == &eventTcpClose) {
 		tcpClose(tcpSocket->wasError());
 	} else
-	if (&event == &eventUdpWrite) {
-		udpWrite(plannedTimeUs);
-	} else
 	if (&event == &eventUdpClose) {
 		udpClose(udpListener->getSocket().wasError());
 	} else
@@ -179,27 +205,57 @@ void Connection::handle(Event &event, long long plannedTimeUs) {
 void Connection::tcpRead() {
 	if (!tcpConnected) return;
 
-	int prevSize = tcpReceivedData.size();
-	int maxSize = udpSendPacketSize;
-	tcpReceivedData.resize(tcpReceivedData.size() + maxSize);
+	// read as much as free space in send window allows, but not less than single packet
+	int count = udpSentPackets.getEnd() - udpSentPackets.getBegin();
+	int maxSize = (getUdpMaxSentCount() - count)*udpSendPacketSize - tcpReceivedSize;
+	maxSize = std::max(udpSendPacketSize, std::min(tcpReceiveChunkSize, maxSize));
+
+	// read directly into payload of staged packets, continue last non-full packet
+	void *buffers[Socket::MaxBuffers];
+	int sizes[Socket::MaxBuffers];
+	int first = tcpReceivedSize/udpSendPacketSize;
+	int offset = tcpReceivedSize%udpSendPacketSize;
+	int buffersCount = 0;
+	int remain = maxSize;
+	do {
+		int i = first + buffersCount;
+		if ((int)tcpReceivedPackets.size() <= i) {
+			tcpReceivedPackets.push_back(Packet());
+			tcpReceivedPackets.back().setPool(&server->packetPool);
+		}
+		Packet &packet = tcpReceivedPackets[i];
+		int o = buffersCount ? 0 : offset;
+		packet.setRawSize(Packet::HeaderSize + udpSendPacketSize);
+		packet.setType(Packet::Data); // clear flags left in recycled slab, size of staged packet depends on them
+		buffers[buffersCount] = (char*)packet.getRawData() + Packet::HeaderSize + o;
+		sizes[buffersCount] = std::min(remain, udpSendPacketSize - o);
+		remain -= sizes[buffersCount++];
+	} while(remain > 0 && buffersCount < Socket::MaxBuffers);
+
+	int size = tcpSocket->read(buffers, sizes, buffersCount);
+	for(int i = 0, left = size; i < buffersCount; left -= sizes[i], ++i) {
+		int o = i ? 0 : offset;
+		tcpReceivedPackets[first + i].setRawSize(Packet::HeaderSize + o + std::max(0, std::min(left, sizes[i])));
+	}
 
-	int size = tcpSocket->read(&tcpReceivedData[prevSize], maxSize);
 	if (size > 0) {
 		server->statTcpReceived += size;
 		if (udpConnected) {
-			tcpReceivedData.resize(prevSize + size);
-
 			#ifdef DUMP_TCP_RECV_PACKETS
 			std::cout << "[" << shortName << " received tcp-packet, size " << size << "]" << std::endl;
 			#ifdef DUMP_TCP_RECV_PACKETS_DATA
-			std::cout.write(&tcpReceivedData[prevSize], size);
+			for(int i = 0, left = size; i < buffersCount && left > 0; left -= sizes[i], ++i)
+				std::cout.write((const char*)buffers[i], std::min(left, sizes[i]));
 			std::cout << std::endl << "[end]" << std::endl;
 			#endif
 			#endif
 
+			tcpReceivedSize += size;
 			buildUdpPackets(false);
-		} else tcpReceivedData.resize(prevSize);
-	} else tcpReceivedData.resize(prevSize);
+		} else {
+			tcpReceivedPackets[first].setRawSize(Packet::HeaderSize + offset);
+		}
+	}
 
 	onUdpSentBufferChanged(0);
 }
@@ -208,21 +264,26 @@ void Connection::tcpWrite(bool fake) {
 	if (tcpConnected && fake) return;
 	if (!tcpConnected && !fake) return;
 
-	while(tcpNextSendIndex < udpReceivedMasterIndex) {
-		std::map<int, Packet>::iterator i = udpReceivedPackets.find(tcpNextSendIndex);
-		if (i == udpReceivedPackets.end()) break;
+	// gather data of contiguous received packets to write it by single call
+	const void *buffers[Socket::MaxBuffers];
+	int sizes[Socket::MaxBuffers];
+	int count = 0;
+
+	for(int index = tcpNextSendIndex; index < udpReceivedMasterIndex && count < Socket::MaxBuffers; ++index) {
+		Packet *packet = udpReceivedPackets.get(index);
+		if (!packet) break;
 
-		Packet::Type type = i->second.getType();
-		const void *data = i->second.getData();
-		int size = i->second.getSize();
+		Packet::Type type = packet->getType();
+		int offset = index == tcpNextSendIndex ? tcpNextSendOffset : 0;
+		int size = packet->getSize() - offset;
 
 		if (fake || type != Packet::Data || size <= 0) {
-			i->second.sent = true;
-			if (i->second.isComplete()) {
-				udpReceiveBufferSize -= size;
-				udpReceivedPackets.erase(i);
-			}
+			if (count > 0) break;
+
+			udpReceiveBufferSize -= size;
+			udpReceivedPackets.erase(tcpNextSendIndex);
 			++tcpNextSendIndex;
+			tcpNextSendOffset = 0;
 
 			if (!fake && type == Packet::Bye) {
 				tcpClose();
@@ -237,37 +298,55 @@ void Connection::tcpWrite(bool fake) {
 			continue;
 		}
 
-		size = tcpSocket->write(data, size);
-		if (size > 0) {
-			server->statTcpSent += size;
+		buffers[count] = (const char*)packet->getData() + offset;
+		sizes[count] = size;
+		++count;
+	}
 
-			#ifdef DUMP_TCP_SENT_PACKETS
-			std::cout << "[" << shortName << " sent tcp-packet (from udp #" << i->first << "), size " << size << "/" << i->second.getSize() << "]" << std::endl;
-			#ifdef DUMP_TCP_SENT_PACKETS_DATA
-			std::cout.write((const char *)data, size);
-			std::cout << std::endl << "[end]" << std::endl;
-			#endif
-			#endif
+	if (count <= 0) return;
 
-			int dataIndex = (const char *)data - &i->second.data.front();
-			i->second.data.erase(i->second.data.begin() + dataIndex, i->second.data.begin() + dataIndex + size);
-			udpReceiveBufferSize -= size;
-			if (i->second.getSize() <= 0) {
-				i->second.sent = true;
-				if (i->second.isComplete()) udpReceivedPackets.erase(i);
-				++tcpNextSendIndex;
+	int size = tcpSocket->write(buffers, sizes, count);
+	if (size > 0) {
+		server->statTcpSent += size;
+
+		#ifdef DUMP_TCP_SENT_PACKETS
+		std::cout << "[" << shortName << " sent tcp-packets (from udp #" << tcpNextSendIndex << ", count " << count << "), size " << size << "]" << std::endl;
+		#ifdef DUMP_TCP_SENT_PACKETS_DATA
+		for(int i = 0, remain = size; i < count && remain > 0; remain -= sizes[i], ++i)
+			std::cout.write((const char *)buffers[i], std::min(remain, sizes[i]));
+		std::cout << std::endl << "[end]" << std::endl;
+		#endif
+		#endif
+
+		udpReceiveBufferSize -= size;
+		for(int i = 0; i < count && size > 0; ++i) {
+			if (size < sizes[i]) {
+				tcpNextSendOffset += size;
+				break;
 			}
+			size -= sizes[i];
+			udpReceivedPackets.erase(tcpNextSendIndex);
+			++tcpNextSendIndex;
+			tcpNextSendOffset = 0;
 		}
-
-		if (tcpNextSendIndex < udpReceivedMasterIndex)
-			eventTcpWrite.setTimeRelativeNow();
-		break;
 	}
+
+	if (tcpNextSendIndex < udpReceivedMasterIndex)
+		eventTcpWrite.setTimeRelativeNow();
 }
 
 void Connection::udpWrite(long long plannedTimeUs) {
 	if (!udpConnected) return;
 
+	// shared udp-socket is busy, listener will raise us again when it becomes writable
+	if (!udpListener->getSocket().sourceWrite.getReady()) {
+		if (!udpWaitWrite) {
+			udpWaitWrite = true;
+			udpListener->waitWrite(*this);
+		}
+		return;
+	}
+
 	if (!udpConfirmationPackets.empty()) {
 		Packet &packet = udpConfirmationPackets.front();
 
@@ -275,180 +354,226 @@ void Connection::udpWrite(long long plannedTimeUs) {
 		if (rand()%100 < (SIMULATE_DAMAGE)) packet.setCrc32(0);
 		#endif
 
-		int size = udpListener->getSocket().writeto(packet.getRawData(), udpAddress, packet.getRawSize(), name);
-		if (size > 0 || packet.getRawSize() == 0) {
-			server->statUdpSent += size;
-			if (size != packet.getRawSize())
-				server->log.warning(name, "confirmation udp-packet sent truncated %d/%d", size, packet.getRawSize());
-
-			#ifdef DUMP_UDP_SENT_CONFIRMATIONS
-			if (packet.getType() == Packet::Confirmation) {
-				int a = 0, b = 0, currentIndex = packet.getIndex();
-				const void *data = (const int *)packet.getData();
-				int size = packet.getSize();
-				std::cout << "[" << shortName << ", sent confirmations, master " << packet.getIndex() << ", indices ";
-				while(Packet::unpackIntPair(a, b, data, size)) {
-					currentIndex += a + b;
-					std::cout << " " << (currentIndex - b) << "-" << (currentIndex-1);
-				}
-				std::cout << "]" << std::endl;
+		#ifdef DUMP_UDP_SENT_CONFIRMATIONS
+		if (packet.getType() == Packet::Confirmation) {
+			int a = 0, b = 0, currentIndex = packet.getIndex();
+			const void *data = (const int *)packet.getData();
+			int size = packet.getSize();
+			std::cout << "[" << shortName << ", sent confirmations, master " << packet.getIndex() << ", indices ";
+			while(Packet::unpackIntPair(a, b, data, size)) {
+				currentIndex += a + b;
+				std::cout << " " << (currentIndex - b) << "-" << (currentIndex-1);
 			}
-			#endif
+			std::cout << "]" << std::endl;
+		}
+		#endif
 
-			#ifdef DUMP_UDP_SENT_BYEBYE
-			if (packet.getType() == Packet::ByeBye)
-				std::cout << "[" << shortName << ", sent bye-bye #" << packet.getIndex() << "]" << std::endl;
-			#endif
+		#ifdef DUMP_UDP_SENT_BYEBYE
+		if (packet.getType() == Packet::ByeBye)
+			std::cout << "[" << shortName << ", sent bye-bye #" << packet.getIndex() << "]" << std::endl;
+		#endif
 
-			udpLastSentUs = plannedTimeUs;
-			onUdpSentBufferChanged(-packet.getSize());
-			udpConfirmationPackets.erase(udpConfirmationPackets.begin());
-			if (isUdpFinished()) {
-				udpClose();
-				return;
-			}
+		udpLastSentUs = plannedTimeUs;
+		onUdpSentBufferChanged(-packet.getSize());
+		udpListener->transmit(*this, std::move(packet));
+		udpConfirmationPackets.pop();
+		if (isUdpFinished()) {
+			udpClose();
+			return;
 		}
 
 		if (!udpConfirmationPackets.empty() || udpPacketsToSendCount > 0)
-			eventUdpWrite.setTime(udpLastSentUs + udpSendIntervalUs);
+			pacer->schedule(*this, udpLastSentUs + udpSendIntervalUs);
 		return;
 	}
 
-	for(std::map<int, Packet>::iterator i = udpSentPackets.begin(); i != udpSentPackets.end(); ++i) {
-		if (!i->second.sent) {
-			Packet &packet = i->second;
+	if (udpSentFirstUnsentIndex < udpSentPackets.getBegin())
+		udpSentFirstUnsentIndex = udpSentPackets.getBegin();
+	for(; udpSentFirstUnsentIndex < udpSentPackets.getEnd(); ++udpSentFirstUnsentIndex) {
+		Packet *p = udpSentPackets.get(udpSentFirstUnsentIndex);
+		if (p && !p->sent) {
+			Packet &packet = *p;
 
 			#ifdef SIMULATE_DAMAGE
 			unsigned int damagedCrc32 = packet.getCrc32();
 			if (rand()%100 < (SIMULATE_DAMAGE)) packet.setCrc32(0);
 			#endif
 
-			int size = udpListener->getSocket().writeto(packet.getRawData(), udpAddress, packet.getRawSize(), name);
+			// packet stays in window until confirmed, so listener gets copy
+			udpListener->transmit(*this, packet);
 
 			#ifdef SIMULATE_DAMAGE
 			packet.setCrc32(damagedCrc32);
 			#endif
 
-			if (size > 0 || packet.getRawSize() == 0) {
-				server->statUdpSent += size;
-
-				if (size != packet.getRawSize())
-					server->log.warning(name, "udp-packet sent truncated %d/%d", size, packet.getRawSize());
-
-				long long timeUs = Platform::nowUs();
-				packet.sent = true;
-				packet.sentTimeUs = timeUs;
-				packet.measureIndex = udpSendMeasureIndex;
-				udpLastSentUs = plannedTimeUs;
+			long long timeUs = server->eventManager.getNowUs();
+			packet.sent = true;
+			packet.sentTimeUs = timeUs;
+			packet.measureIndex = udpSendMeasureIndex;
+			udpLastSentUs = plannedTimeUs;
 
-				onUdpSent(udpSendMeasureIndex, udpSendIntervalUs, packet.getSize());
+			onUdpSent(udpSendMeasureIndex, udpSendIntervalUs, packet.getSize());
 
-				--udpPacketsToSendCount;
+			--udpPacketsToSendCount;
 
-				#ifdef DUMP_UDP_SENT_HANDSHAKINGS
-				switch(packet.getType()) {
-				case Packet::Hello:
-					std::cout << "[" << shortName << " sent hello]" << std::endl;
-					break;
-				case Packet::Bye:
-					std::cout << "[" << shortName << " sent bye #" << packet.getIndex() << "]" << std::endl;
-					break;
-				case Packet::Disconnect:
-					std::cout << "[" << shortName << " sent disconnect #" << packet.getIndex() << "]" << std::endl;
-					break;
-				default:
-					break;
-				}
-				#endif
+			#ifdef DUMP_UDP_SENT_HANDSHAKINGS
+			switch(packet.getType()) {
+			case Packet::Hello:
+				std::cout << "[" << shortName << " sent hello]" << std::endl;
+				break;
+			case Packet::Bye:
+				std::cout << "[" << shortName << " sent bye #" << packet.getIndex() << "]" << std::endl;
+				break;
+			case Packet::Disconnect:
+				std::cout << "[" << shortName << " sent disconnect #" << packet.getIndex() << "]" << std::endl;
+				break;
+			default:
+				break;
+			}
+			#endif
 
-				#ifdef DUMP_UDP_SENT_PACKETS
-				if (packet.getType() == Packet::Data) {
-					std::cout << "[" << shortName << " sent udp-packet #" << packet.getIndex() << ", size " << packet.getSize() << "]" << std::endl;
-					#ifdef DUMP_UDP_SENT_PACKETS_DATA
-					std::cout.write((const char*)packet.getData(), packet.getSize());
-					std::cout << std::endl << "[end]" << std::endl;
-					#endif
-				}
+			#ifdef DUMP_UDP_SENT_PACKETS
+			if (packet.getType() == Packet::Data) {
+				std::cout << "[" << shortName << " sent udp-packet #" << packet.getIndex() << ", size " << packet.getSize() << "]" << std::endl;
+				#ifdef DUMP_UDP_SENT_PACKETS_DATA
+				std::cout.write((const char*)packet.getData(), packet.getSize());
+				std::cout << std::endl << "[end]" << std::endl;
 				#endif
+			}
+			#endif
 
-				if (packet.isComplete()) {
-					server->log.warning(name, "packet was confirmed before sent #%d", packet.getIndex());
-					onUdpSentBufferChanged(-packet.getSize());
-					udpSentPackets.erase(i);
-					if (isUdpFinished()) {
-						udpClose();
-						return;
-					}
-				} else {
-					eventUdpResend.setTimeRelativeNow(udpResendUs);
+			if (packet.isComplete()) {
+				server->log.warning(name, "packet was confirmed before sent #%d", packet.getIndex());
+				onUdpSentBufferChanged(-packet.getSize());
+				udpSentPackets.erase(udpSentFirstUnsentIndex);
+				if (isUdpFinished()) {
+					udpClose();
+					return;
 				}
+			} else {
+				eventUdpResend.setTimeRelativeNow(udpResendUs);
 			}
 
 			if (udpPacketsToSendCount > 0)
-				eventUdpWrite.setTime(udpLastSentUs + udpSendIntervalUs);
+				pacer->schedule(*this, udpLastSentUs + udpSendIntervalUs);
 			return;
 		}
 	}
 
-	//server->log.warning(name, "eventUdpWrite raised, but nothing to write");
+	//server->log.warning(name, "paced udp-write, but nothing to write");
+}
+
+void Connection::onUdpWritable() {
+	udpWaitWrite = false;
+	pacer->schedule(*this, server->eventManager.getNowUs());
+}
+
+void Connection::onUdpTransmitFailed(const Packet &packet) {
+	if (!udpConnected) return;
+
+	// packets from send window will be sent again,
+	// lost confirmations will be replaced by next ones
+	switch(packet.getType()) {
+	case Packet::Hello:
+	case Packet::Bye:
+	case Packet::Data:
+	case Packet::Disconnect:
+		if (Packet *i = udpSentPackets.get(packet.getIndex())) {
+			if (i->sent && !i->confirmed) {
+				++udpPacketsToSendCount;
+				i->sent = false;
+				udpSentFirstUnsentIndex = std::min(udpSentFirstUnsentIndex, packet.getIndex());
+				onUdpDelivered(false, i->measureIndex, i->getSize());
+			}
+		}
+		break;
+	default:
+		break;
+	}
+
+	if (!udpWaitWrite) {
+		udpWaitWrite = true;
+		udpListener->waitWrite(*this);
+	}
 }
 
 void Connection::buildUdpPackets(bool flush) {
 	if (!udpConnected) return;
 
 	if (udpReceivedFinalIndex == udpReceivedMasterIndex)
-		tcpReceivedData.clear();
+		tcpReceivedSize = 0;
 
+	// move staged packets into send window, payload is already in place
+	int count = 0;
 	int fullSize = 0;
-	for(int i = 0; i < (int)tcpReceivedData.size(); i += udpSendPacketSize) {
-		int size = std::min((int)tcpReceivedData.size() - i, udpSendPacketSize);
+	int packetsSize = 0;
+	while(fullSize < tcpReceivedSize) {
+		Packet &staged = tcpReceivedPackets[count];
+		int size = staged.getSize();
 		if (!flush && size < udpSendPacketSize) break;
 		if (size <= 0) break;
 
 		++udpPacketsToSendCount;
 
-		Packet &packet = udpSentPackets[udpNextSendIndex];
+		Packet &packet = udpSentPackets.insert(udpNextSendIndex);
+		packet = std::move(staged);
 		packet.remainResendCount = udpResendCount;
-		packet.encode(Packet::Data, udpNextSendIndex, &tcpReceivedData[i], size);
+		packet.encode(Packet::Data, udpNextSendIndex, NULL, size, getSendConnectionId());
 		udpNextSendIndex++;
 
-		setEventUdpWrite();
-
-		onUdpSentBufferChanged(packet.getSize());
+		packetsSize += packet.getSize();
 		fullSize += size;
+		++count;
 	}
-	tcpReceivedData.erase(tcpReceivedData.begin(), tcpReceivedData.begin() + fullSize);
 
-	if (fullSize > 0 || tcpReceivedData.empty())
+	if (fullSize > 0) {
+		tcpReceivedSize -= fullSize;
+		if (tcpReceivedSize > 0)
+			std::swap(tcpReceivedPackets[0], tcpReceivedPackets[count]);
+		setEventUdpWrite();
+		onUdpSentBufferChanged(packetsSize);
+	}
+
+	if (fullSize > 0 || tcpReceivedSize <= 0)
 		eventBuildUdpPackets.disable();
-	if (!tcpReceivedData.empty())
+	if (tcpReceivedSize > 0)
 		eventBuildUdpPackets.setTimeRelativeNow(buildUdpPacketsUs);
+	else
+		applyPendingSendPacketSize();
+}
+
+void Connection::applyPendingSendPacketSize() {
+	if (udpPendingSendPacketSize <= 0) return;
+	udpSendPacketSize = std::min(udpSendPacketSize, udpPendingSendPacketSize);
+	udpPendingSendPacketSize = 0;
 }
 
 void Connection::buildConfirmations() {
 	if (!udpConnected) return;
 
-	for(std::list<Packet>::iterator i = udpConfirmationPackets.begin(); i != udpConfirmationPackets.end();)
-		if (i->getType() == Packet::Confirmation) {
-			onUdpSentBufferChanged(-i->getSize());
-			i = udpConfirmationPackets.erase(i);
-		} else ++i;
+	for(int i = udpConfirmationPackets.getBegin(); i < udpConfirmationPackets.getEnd(); ++i)
+		if (Packet *packet = udpConfirmationPackets.get(i))
+			if (packet->getType() == Packet::Confirmation) {
+				onUdpSentBufferChanged(-packet->getSize());
+				udpConfirmationPackets.erase(i);
+			}
 
 	// pack confirmations
 	confirmationData.resize(udpSendPacketSize);
 	int prevIndex = udpReceivedMasterIndex;
 	void *data = &confirmationData.front();
 	int size = (int)confirmationData.size();
-	for(std::map<int, Packet>::iterator i = udpReceivedPackets.lower_bound(udpReceivedMasterIndex); i != udpReceivedPackets.end();) {
-		int begin = i->first;
+	for(int i = udpReceivedMasterIndex; i < udpReceivedPackets.getEnd();) {
+		if (!udpReceivedPackets.get(i)) { ++i; continue; }
+		int begin = i;
 		int end = begin + 1;
-		++i;
-		while(i != udpReceivedPackets.end() && i->first == end) ++i, ++end;
+		while(udpReceivedPackets.get(end)) ++end;
+		i = end;
 
 		if (!Packet::packIntPair(begin - prevIndex, end - begin, data, size)) {
-			udpConfirmationPackets.push_back(Packet());
-			Packet &packet = udpConfirmationPackets.back();
-			packet.encode(Packet::Confirmation, udpReceivedMasterIndex, &confirmationData.front(), (int)confirmationData.size() - size);
+			Packet &packet = udpConfirmationPackets.push();
+			packet.setPool(&server->packetPool);
+			packet.encode(Packet::Confirmation, udpReceivedMasterIndex, &confirmationData.front(), (int)confirmationData.size() - size, getSendConnectionId());
 			onUdpSentBufferChanged(packet.getSize());
 
 			data = &confirmationData.front();
@@ -461,9 +586,9 @@ void Connection::buildConfirmations() {
 
 		prevIndex = end;
 	}
-	udpConfirmationPackets.push_back(Packet());
-	Packet &packet = udpConfirmationPackets.back();
-	packet.encode(Packet::Confirmation, udpReceivedMasterIndex, &confirmationData.front(), (int)confirmationData.size() - size);
+	Packet &packet = udpConfirmationPackets.push();
+	packet.setPool(&server->packetPool);
+	packet.encode(Packet::Confirmation, udpReceivedMasterIndex, &confirmationData.front(), (int)confirmationData.size() - size, getSendConnectionId());
 	onUdpSentBufferChanged(packet.getSize());
 
 	udpConfirmedMasterIndex = udpReceivedMasterIndex;
@@ -472,10 +597,11 @@ void Connection::buildConfirmations() {
 	#ifdef CHECK_CONFIRMATIONS
 	bool success = true;
 	std::set<int> unconfirmedIndices;
-	for(std::map<int, Packet>::const_iterator i = udpReceivedPackets.lower_bound(udpReceivedMasterIndex); i != udpReceivedPackets.end(); ++i)
-		unconfirmedIndices.insert(i->first);
-	for(std::list<Packet>::const_iterator i = udpConfirmationPackets.begin(); i != udpConfirmationPackets.end(); ++i) {
-		if (i->getType() == Packet::Confirmation) {
+	for(int i = udpReceivedMasterIndex; i < udpReceivedPackets.getEnd(); ++i)
+		if (udpReceivedPackets.get(i)) unconfirmedIndices.insert(i);
+	for(int ii = udpConfirmationPackets.getBegin(); ii < udpConfirmationPackets.getEnd(); ++ii) {
+		const Packet *i = udpConfirmationPackets.get(ii);
+		if (i && i->getType() == Packet::Confirmation) {
 			int a = 0, b = 0, currentIndex = i->getIndex();
 			if (currentIndex != udpReceivedMasterIndex) {
 				server->log.error(name, "buildConfirmations: wrong master index %d (should be %d)", currentIndex, udpReceivedMasterIndex);
@@ -486,7 +612,7 @@ void Connection::buildConfirmations() {
 			while(Packet::unpackIntPair(a, b, data, size)) {
 				currentIndex += a + b;
 				for(int j = currentIndex - b; j < currentIndex; ++j) {
-					if (udpReceivedPackets.count(j) == 0)
+					if (!udpReceivedPackets.get(j))
 						{ server->log.error(name, "buildConfirmations: wrong index %d", j); success = false; }
 					else
 					if (unconfirmedIndices.count(j) == 0)
@@ -501,8 +627,9 @@ void Connection::buildConfirmations() {
 	for(std::set<int>::const_iterator i = unconfirmedIndices.begin(); i != unconfirmedIndices.end(); ++i)
 		{ server->log.error(name, "buildConfirmations: unconfirmed index %d", *i); success = false; }
 	if (!success) {
-		for(std::list<Packet>::const_iterator i = udpConfirmationPackets.begin(); i != udpConfirmationPackets.end(); ++i) {
-			if (i->getType() == Packet::Confirmation) {
+		for(int ii = udpConfirmationPackets.getBegin(); ii < udpConfirmationPackets.getEnd(); ++ii) {
+			const Packet *i = udpConfirmationPackets.get(ii);
+			if (i && i->getType() == Packet::Confirmation) {
 				int a = 0, b = 0, currentIndex = i->getIndex();
 				const void *data = (const int *)i->getData();
 				int size = i->getSize();
@@ -517,15 +644,6 @@ void Connection::buildConfirmations() {
 	}
 	#endif
 
-	// TODO: optimize - quick erase items with index < tcpNextSendIndex
-	for(std::map<int, Packet>::iterator i = udpReceivedPackets.begin(); i != udpReceivedPackets.end() && i->first < tcpNextSendIndex;) {
-		i->second.confirmed = i->first < udpReceivedMasterIndex;
-		if (i->second.isComplete()) {
-			udpReceiveBufferSize -= i->second.getSize();
-			udpReceivedPackets.erase(i++);
-		} else ++i;
-	}
-
 	--remainConfirmationResendCount;
 	if (remainConfirmationResendCount > 0)
 		eventBuildConfirmations.setTimeRelativeNow(buildConfirmationsUs);
@@ -534,9 +652,9 @@ void Connection::buildConfirmations() {
 void Connection::buildByeBye() {
 	if (!udpConnected) return;
 
-	udpConfirmationPackets.push_back(Packet());
-	Packet &packet = udpConfirmationPackets.back();
-	packet.encode(Packet::ByeBye, udpNextSendIndex);
+	Packet &packet = udpConfirmationPackets.push();
+	packet.setPool(&server->packetPool);
+	packet.encode(Packet::ByeBye, udpNextSendIndex, NULL, 0, getSendConnectionId());
 
 	onUdpSentBufferChanged(packet.getSize());
 	setEventUdpWrite();
@@ -549,21 +667,23 @@ void Connection::buildByeBye() {
 void Connection::udpResend() {
 	if (!udpConnected) return;
 
-	long long timeUs = Platform::nowUs();
-	for(std::map<int, Packet>::iterator i = udpSentPackets.begin(); i != udpSentPackets.end(); ++i) {
-		if (i->second.sent) {
-			if (i->second.sentTimeUs + udpResendUs <= timeUs) {
-				if (i->second.remainResendCount > 0) {
+	long long timeUs = server->eventManager.getNowUs();
+	for(int index = udpSentPackets.getBegin(); index < udpSentPackets.getEnd(); ++index) {
+		Packet *i = udpSentPackets.get(index);
+		if (i && i->sent) {
+			if (i->sentTimeUs + udpResendUs <= timeUs) {
+				if (i->remainResendCount > 0) {
 					++udpPacketsToSendCount;
 
-					i->second.sent = false;
-					i->second.remainResendCount--;
+					i->sent = false;
+					i->remainResendCount--;
+					udpSentFirstUnsentIndex = std::min(udpSentFirstUnsentIndex, index);
 
 					#ifdef DUMP_UDP_RESEND
-					std::cout << "[" << shortName << " resend udp-packet #" << i->second.getIndex() << ", size " << i->second.getSize() << "]" << std::endl;
+					std::cout << "[" << shortName << " resend udp-packet #" << i->getIndex() << ", size " << i->getSize() << "]" << std::endl;
 					#endif
 
-					onUdpDelivered(false, i->second.measureIndex, i->second.getSize());
+					onUdpDelivered(false, i->measureIndex, i->getSize());
 					setEventUdpWrite();
 				} else {
 					server->log.error(name, "remote udp host don't answers");
@@ -571,15 +691,35 @@ void Connection::udpResend() {
 					return;
 				}
 			} else {
-				eventUdpResend.setTime(i->second.sentTimeUs + udpResendUs);
+				eventUdpResend.setTime(i->sentTimeUs + udpResendUs);
 			}
 		}
 	}
 }
 
-void Connection::udpRead(const Packet &packet) {
+void Connection::udpRead(Packet &packet, const Address &address) {
 	if (!udpConnected) return;
 
+	// remote side tags packets by id proposed in our hello, so it knows id
+	if (!connectionIdNegotiated && packet.hasConnectionId() && packet.getConnectionId() == connectionId)
+		connectionIdNegotiated = true;
+
+	// remote address may change only by tagged packet which is fresh: has index not received yet
+	// (even if it does not fit receive window now) or confirms new packets,
+	// so late duplicates from previous address and replays do not turn connection back,
+	// but when current address is silent for resend interval, repeats are enough,
+	// else stalled peer whose confirmations are lost at dead address would never come back
+	long long timeUs = server->eventManager.getNowUs();
+	bool addressChanged = packet.hasConnectionId() && address != udpAddress;
+	if (address == udpAddress) udpLastReceivedUs = timeUs;
+	Packet::Type type = packet.getType();
+	bool fresh = type != Packet::Confirmation && type != Packet::ByeBye && packet.getIndex() >= udpReceivedMaxIndex;
+	int prevSentCount = udpSentPackets.getCount();
+
+	// received packet takes slab of locally configured size, whatever size remote side proposed,
+	// so window of received indices is bounded by local size
+	int maxReceiveCount = 2*udpMaxReceiveBufferSize/server->udpSendPacketSize;
+
 	if (packet.getType() == Packet::Confirmation) {
 		bool prevNoMoreDataWillBeSent = isNoMoreDataWillBeSent();
 
@@ -601,42 +741,28 @@ void Connection::udpRead(const Packet &packet) {
 		}
 		#endif
 
-		for(std::map<int, Packet>::iterator i = udpSentPackets.begin(); i != udpSentPackets.end();) {
-			if (i->first < masterIndex) {
-				if (!i->second.confirmed)
-					onUdpDelivered(true, i->second.measureIndex, i->second.getSize());
-				if (!i->second.sent)
-					--udpPacketsToSendCount;
-
-				i->second.sent = true;
-				i->second.confirmed = true;
-				if (i->second.isComplete()) {
-					onUdpSentBufferChanged(-i->second.getSize());
-					udpSentPackets.erase(i++);
-					continue;
-				}
-			} else break;
-			++i;
+		while(!udpSentPackets.empty() && udpSentPackets.getBegin() < masterIndex) {
+			Packet &i = udpSentPackets.front();
+			if (!i.confirmed)
+				onUdpDelivered(true, i.measureIndex, i.getSize());
+			if (!i.sent)
+				--udpPacketsToSendCount;
+			onUdpSentBufferChanged(-i.getSize());
+			udpSentPackets.pop();
 		}
 
 		int currentIndex = masterIndex;
 		int a, b;
 		while(Packet::unpackIntPair(a, b, data, size)) {
 			currentIndex += a + b;
-			for(int i = currentIndex - b; i < currentIndex; ++i) {
-				std::map<int, Packet>::iterator j = udpSentPackets.find(i);
-				if (j != udpSentPackets.end()) {
-					if (!j->second.confirmed)
-						onUdpDelivered(true, j->second.measureIndex, j->second.getSize());
-					if (!j->second.sent)
+			for(int i = std::max(currentIndex - b, udpSentPackets.getBegin()); i < currentIndex && i < udpSentPackets.getEnd(); ++i) {
+				if (Packet *j = udpSentPackets.get(i)) {
+					if (!j->confirmed)
+						onUdpDelivered(true, j->measureIndex, j->getSize());
+					if (!j->sent)
 						--udpPacketsToSendCount;
-
-					j->second.sent = true;
-					j->second.confirmed = true;
-					if (j->second.isComplete()) {
-						onUdpSentBufferChanged(-j->second.getSize());
-						udpSentPackets.erase(j);
-					}
+					onUdpSentBufferChanged(-j->getSize());
+					udpSentPackets.erase(i);
 				}
 			}
 		}
@@ -645,10 +771,10 @@ void Connection::udpRead(const Packet &packet) {
 
 		server->statUdpReceivedExtra += packet.getRawSize();
 
-		if (udpPacketsToSendCount >= (int)udpSentPackets.size())
+		if (udpPacketsToSendCount >= udpSentPackets.getCount())
 			eventUdpResend.disable();
 		//if (udpPacketsToSendCount <= 0 && udpConfirmationPackets.empty())
-		//	eventUdpWrite.disable();
+		//	pacer->cancel(*this);
 
 		if (isNoMoreDataWillBeSent() && !prevNoMoreDataWillBeSent) {
 			remainByeByeResendCount = confirmationResendCount;
@@ -657,14 +783,14 @@ void Connection::udpRead(const Packet &packet) {
 	} else
 	if ( packet.getIndex() >= udpReceivedMasterIndex
 	  && packet.getIndex() < udpReceivedFinalIndex
-	  && (packet.getIndex() - tcpNextSendIndex <= 2*udpMaxReceiveBufferSize/udpSendPacketSize)
+	  && (packet.getIndex() - tcpNextSendIndex <= maxReceiveCount)
 	  //&& (udpReceiveBufferSize < udpMaxReceiveBufferSize || (tcpNextSendIndex == udpReceivedMasterIndex && packet.getIndex() == udpReceivedMasterIndex))
 	  && ( (packet.getType() == Packet::Hello && packet.getIndex() == 0)
 	    || packet.getType() == Packet::Bye
 	    || packet.getType() == Packet::Disconnect
 	    || packet.getType() == Packet::Data ))
 	{
-		if (!udpReceivedPackets.count(packet.getIndex())) {
+		if (!udpReceivedPackets.get(packet.getIndex())) {
 			#ifdef DUMP_UDP_RECV_HANDSHAKINGS
 			if (packet.getType() == Packet::Hello)
 				std::cout << "[" << shortName << " received hello]" << std::endl;
@@ -686,12 +812,17 @@ void Connection::udpRead(const Packet &packet) {
 			}
 			#endif
 
-			Packet &newPacket = udpReceivedPackets[packet.getIndex()];
-			newPacket = packet;
+			udpReceivedMaxIndex = std::max(udpReceivedMaxIndex, packet.getIndex() + 1);
+			Packet &newPacket = udpReceivedPackets.insert(packet.getIndex());
+			newPacket = std::move(packet);
 			udpReceiveBufferSize +=	newPacket.getSize();
+			if (newPacket.getType() == Packet::Hello)
+				udpReadHello(newPacket);
 
-			while(udpReceivedPackets.count(udpReceivedMasterIndex) && udpReceivedMasterIndex < udpReceivedFinalIndex) {
-				Packet::Type type = udpReceivedPackets[udpReceivedMasterIndex].getType();
+			while(udpReceivedMasterIndex < udpReceivedFinalIndex) {
+				const Packet *received = udpReceivedPackets.get(udpReceivedMasterIndex);
+				if (!received) break;
+				Packet::Type type = received->getType();
 				++udpReceivedMasterIndex;
 				if (type == Packet::Bye || type == Packet::Disconnect)
 					udpReceivedFinalIndex = udpReceivedMasterIndex;
@@ -718,29 +849,112 @@ void Connection::udpRead(const Packet &packet) {
 
 		remainConfirmationResendCount = 0;
 		eventBuildConfirmations.disable();
-		for(std::list<Packet>::iterator i = udpConfirmationPackets.begin(); i != udpConfirmationPackets.end();)
-			if (i->getType() == Packet::Confirmation) {
-				onUdpSentBufferChanged(-i->getSize());
-				i = udpConfirmationPackets.erase(i);
-			} else ++i;
+		for(int i = udpConfirmationPackets.getBegin(); i < udpConfirmationPackets.getEnd(); ++i)
+			if (Packet *confirmation = udpConfirmationPackets.get(i))
+				if (confirmation->getType() == Packet::Confirmation) {
+					onUdpSentBufferChanged(-confirmation->getSize());
+					udpConfirmationPackets.erase(i);
+				}
 
 		//if (udpPacketsToSendCount <= 0 && udpConfirmationPackets.empty())
-		//	eventUdpWrite.disable();
+		//	pacer->cancel(*this);
 		if (eventUdpCloseWait.isEnabled())
 			eventUdpCloseWait.setTimeRelativeNow(udpResendUs*confirmationResendCount/3 + udpResendUs);
 	} else {
 		server->statUdpReceivedExtra += packet.getRawSize();
 	}
 
+	// address proved by fresh packet while changes are too often waits,
+	// and any next packet from it completes change
+	if (addressChanged && udpConnected) {
+		if ( fresh
+		  || (type == Packet::Confirmation && udpSentPackets.getCount() < prevSentCount)
+		  || timeUs - udpLastReceivedUs >= udpResendUs )
+			udpPendingAddress = address;
+		if (address == udpPendingAddress && timeUs >= udpAddressChangeAllowedUs) {
+			udpAddressChangeAllowedUs = timeUs + server->udpAddressChangeUs;
+			udpLastReceivedUs = timeUs;
+			udpPendingAddress.clear();
+			setUdpAddress(address);
+		}
+	}
+
 	if (isUdpFinished()) {
 		udpClose();
 		return;
 	}
 }
 
+void Connection::udpReadHello(const Packet &packet) {
+	remoteProtocolVersion = packet.getHelloVersion();
+	capabilities = Packet::Capabilities & packet.getHelloCapabilities();
+
+	// id is chosen by side which opened connection, other side adopts it and confirms
+	// by own hello, then both sides tag packets, so connection survives change of remote address,
+	// untagged hello to shared port was steered by address, so when adopted id would steer
+	// tagged packets to other socket, other side proposes own id and waits for packet tagged by it
+	if (capabilities & Packet::CapabilityConnectionId) {
+		unsigned int helloConnectionId = packet.getHelloConnectionId();
+		if (!connectionId && helloConnectionId) {
+			connectionId = packet.hasConnectionId() || udpListener->isSteeredTogether(helloConnectionId, udpAddress)
+			             ? helloConnectionId : udpListener->createConnectionId(udpAddress);
+			if (udpListener->addConnectionId(*this)) {
+				connectionIdNegotiated = connectionId == helloConnectionId;
+				Packet *hello = udpSentPackets.get(0);
+				if (hello && !hello->sent && hello->getType() == Packet::Hello)
+					hello->encodeHello(0, Packet::Capabilities, hello->getHelloPacketSize(), connectionId, getSendConnectionId());
+			} else {
+				server->log.warning(name, "connection id %u already in use", connectionId);
+				connectionId = 0;
+			}
+		} else
+		if (connectionId && helloConnectionId && !connectionIdNegotiated) {
+			if (helloConnectionId != connectionId) {
+				unsigned int prevConnectionId = connectionId;
+				udpListener->removeConnectionId(*this);
+				connectionId = helloConnectionId;
+				if (!udpListener->addConnectionId(*this)) {
+					server->log.warning(name, "connection id %u already in use", connectionId);
+					connectionId = prevConnectionId;
+					udpListener->addConnectionId(*this);
+				}
+			}
+			connectionIdNegotiated = connectionId == helloConnectionId;
+		}
+	}
+
+	// both sides uses the smallest of proposed packet sizes,
+	// data already staged with previous size sends as is,
+	// new size applies when staged data leaves
+	int packetSize = packet.getHelloPacketSize();
+	if (packetSize > 0 && packetSize < Packet::MinPacketSize) {
+		server->log.warning(name, "remote side proposed too small packet size %d, use %d", packetSize, (int)Packet::MinPacketSize);
+		packetSize = Packet::MinPacketSize;
+	}
+	if (packetSize > 0 && packetSize < udpSendPacketSize) {
+		udpPendingSendPacketSize = packetSize;
+		if (tcpReceivedSize > 0) buildUdpPackets(true);
+		if (tcpReceivedSize <= 0) applyPendingSendPacketSize();
+		else server->log.info(name, "packet size %d postponed until staged data sent", packetSize);
+	}
+
+	#ifdef LOG_STATE
+	server->log.info(name, "remote protocol version %d, capabilities %08x, packet size %d, connection id %u",
+		remoteProtocolVersion, capabilities, udpSendPacketSize, getSendConnectionId() );
+	#endif
+}
+
+void Connection::setUdpAddress(const Address &udpAddress) {
+	if (this->udpAddress == udpAddress) return;
+	Address prevUdpAddress = this->udpAddress;
+	this->udpAddress = udpAddress;
+	udpListener->onConnectionAddressChanged(*this, prevUdpAddress);
+	server->log.info(name, "remote udp-address changed to %s", udpAddress.toString().c_str());
+}
+
 bool Connection::isNoMoreDataWillBeSent() {
 	return (!tcpConnected || udpReceivedFinalIndex == udpReceivedMasterIndex)
-		&& tcpReceivedData.empty()
+		&& tcpReceivedSize <= 0
 		&& udpSentPackets.empty();
 }
 
@@ -755,13 +969,15 @@ bool Connection::isUdpFinished() {
 		&& !eventUdpCloseWait.isEnabled();
 }
 
+int Connection::getUdpMaxSentCount() const {
+	int maxCount = (int)(10ll*1000000ll/std::max(1ll, udpSendIntervalUs));
+	return std::min(maxCount, udpMaxSentBufferSize/udpSendPacketSize);
+}
+
 void Connection::onUdpSentBufferChanged(int sizeIncrement) {
 	udpSentBufferSize += sizeIncrement;
-	int count = udpSentPackets.empty() ? 0
-			  : udpSentPackets.end()->first - udpSentPackets.begin()->first;
-	int maxCount = (int)(10ll*1000000ll/udpSendIntervalUs);
-	maxCount = std::min(maxCount, udpMaxSentBufferSize/udpSendPacketSize);
-	if (count <= maxCount)
+	int count = udpSentPackets.getEnd() - udpSentPackets.getBegin();
+	if (count <= getUdpMaxSentCount())
 		eventTcpRead.setTimeRelativeNow();
 	else
 		eventTcpRead.disable();
@@ -769,38 +985,38 @@ void Connection::onUdpSentBufferChanged(int sizeIncrement) {
 
 void Connection::onUdpSent(int measureIndex, long long intervalUs, int size) {
 	if (measureIndex != udpSendMeasureIndex) return;
-	std::map<int, Measure>::iterator i = udpSendMeasures.find(udpSendMeasureIndex);
-	if (i == udpSendMeasures.end()) return;
-
-	++i->second.count;
-	i->second.size += size;
-	i->second.summaryIntervalUs += intervalUs;
-	long long timeUs = Platform::nowUs();
-	if (i->second.size >= udpMaxSentMeasureSize || timeUs - i->second.beginUs >= udpMaxSentMeasureUs) {
-		i->second.endUs = timeUs;
-		udpSendMeasures[++udpSendMeasureIndex].beginUs = timeUs;
+	Measure *i = udpSendMeasures.get(udpSendMeasureIndex);
+	if (!i) return;
+
+	++i->count;
+	i->size += size;
+	i->summaryIntervalUs += intervalUs;
+	long long timeUs = server->eventManager.getNowUs();
+	if (i->size >= udpMaxSentMeasureSize || timeUs - i->beginUs >= udpMaxSentMeasureUs) {
+		i->endUs = timeUs;
+		udpSendMeasures.insert(++udpSendMeasureIndex).beginUs = timeUs;
 	}
 }
 
 void Connection::onUdpDelivered(bool success, int measureIndex, int size) {
-	std::map<int, Measure>::iterator i = udpSendMeasures.find(measureIndex);
-	if (i == udpSendMeasures.end()) return;
+	Measure *i = udpSendMeasures.get(measureIndex);
+	if (!i) return;
 
-	(success ? i->second.successSize : i->second.failSize) += size;
+	(success ? i->successSize : i->failSize) += size;
 
-	if ( i->second.beginUs >= 0
-	  && i->second.endUs >= i->second.beginUs
-	  && i->second.count > 0
-	  && i->second.successSize + i->second.failSize >= i->second.size
+	if ( i->beginUs >= 0
+	  && i->endUs >= i->beginUs
+	  && i->count > 0
+	  && i->successSize + i->failSize >= i->size
 	) {
-		double durationUs = (double)(i->second.endUs - i->second.beginUs);
-		double intervalUs = (double)i->second.summaryIntervalUs/(double)i->second.count;
-		double actualIntervalUs = durationUs/(double)i->second.count;
+		double durationUs = (double)(i->endUs - i->beginUs);
+		double intervalUs = (double)i->summaryIntervalUs/(double)i->count;
+		double actualIntervalUs = durationUs/(double)i->count;
 
-		double successPart = (double)i->second.successSize/(double)i->second.size;
+		double successPart = (double)i->successSize/(double)i->size;
 
 		double speedAmplifier = (double)successPart/(1.0 - 0.01*udpMaxSendLossPercent);
-		if (i->second.failSize <= 0) speedAmplifier = 2.0;
+		if (i->failSize <= 0) speedAmplifier = 2.0;
 		if (speedAmplifier > 1.0 && actualIntervalUs > (intervalUs + 1.0)*2.0) speedAmplifier = 1.0;
 		if (speedAmplifier < 0.5) speedAmplifier = 0.50;
 		if (speedAmplifier > 2.0) speedAmplifier = 2.0;
@@ -824,16 +1040,14 @@ void Connection::onUdpDelivered(bool success, int measureIndex, int size) {
 		std::cout << "[" << shortName << " udp send interval " << udpSendIntervalUs << ", us]" << std::endl;
 		#endif
 
-		while(i != udpSendMeasures.begin())
-			udpSendMeasures.erase(i--);
-		udpSendMeasures.erase(i);
+		udpSendMeasures.eraseBefore(measureIndex + 1);
 	}
 }
 
 void Connection::setEventUdpWrite() {
-	if (!eventUdpWrite.isEnabled())
-		udpLastSentUs = std::max(udpLastSentUs, Platform::nowUs() - udpSendIntervalUs);
-	eventUdpWrite.setTime(udpLastSentUs + udpSendIntervalUs);
+	if (!pacer->isScheduled(*this))
+		udpLastSentUs = std::max(udpLastSentUs, server->eventManager.getNowUs() - udpSendIntervalUs);
+	pacer->schedule(*this, udpLastSentUs + udpSendIntervalUs);
 }
 
 void Connection::tcpClose(bool error) {
@@ -856,9 +1070,10 @@ void Connection::tcpClose(bool error) {
 	tcpWrite(true);
 	buildUdpPackets(true);
 
-	Packet &packet = udpSentPackets[udpNextSendIndex];
+	Packet &packet = udpSentPackets.insert(udpNextSendIndex);
+	packet.setPool(&server->packetPool);
 	packet.remainResendCount = udpResendCount;
-	packet.encode(error ? Packet::Disconnect : Packet::Bye, udpNextSendIndex);
+	packet.encode(error ? Packet::Disconnect : Packet::Bye, udpNextSendIndex, NULL, 0, getSendConnectionId());
 	udpNextSendIndex++;
 
 	++udpPacketsToSendCount;
@@ -880,10 +1095,11 @@ void Connection::udpClose(bool /* error */) {
 	eventBuildConfirmations.disable();
 	eventUdpResend.disable();
 	eventTcpRead.disable();
-	eventUdpWrite.disable();
+	pacer->cancel(*this);
 	tcpSocket->closeRead();
 
-	tcpReceivedData.clear();
+	tcpReceivedPackets.clear();
+	tcpReceivedSize = 0;
 	udpConfirmationPackets.clear();
 	udpSentPackets.clear();
 	onUdpSentBufferChanged(-udpSentBufferSize);
@@ -18,18 +18,18 @@
 #ifndef _CONNECTION_H_
 #define _CONNECTION_H_
 
-#include <map>
 #include <vector>
 #include <string>
-#include <list>
 
 #include "event.h"
 #include "packet.h"
+#include "window.h"
 #include "address.h"
 #include "socket.h"
 
 class Server;
 class UdpListener;
+class Pacer;
 
 struct Measure {
 	long long beginUs;
@@ -54,6 +54,8 @@ struct Measure {
 
 class Connection: public Event::Handler {
 private:
+	friend class Pacer;
+
 	Server *server;
 
 	std::string name;
@@ -62,11 +64,16 @@ private:
 	Socket *tcpSocket;
 	UdpListener *udpListener;
 	Address udpAddress;
+	unsigned int connectionId;
+	bool connectionIdNegotiated;
 
 	bool tcpConnected;
 	bool udpConnected;
+	bool udpWaitWrite;
 
+	int tcpReceiveChunkSize;
 	int udpSendPacketSize;
+	int udpPendingSendPacketSize;
 	int udpMaxSentBufferSize;
 	int udpMaxReceiveBufferSize;
 	int udpMaxSentMeasureSize;
@@ -79,6 +86,7 @@ private:
 	long long udpMaxSentMeasureUs;
 
 	int tcpNextSendIndex;
+	int tcpNextSendOffset;
 	int udpNextSendIndex;
 	int udpReceivedMasterIndex;
 	int udpConfirmedMasterIndex;
@@ -89,23 +97,37 @@ private:
 	int remainConfirmationResendCount;
 	int remainByeByeResendCount;
 
-	std::vector<char> tcpReceivedData;
+	int remoteProtocolVersion;
+	unsigned int capabilities;
+
+	std::vector<Packet> tcpReceivedPackets;
+	int tcpReceivedSize;
 	std::vector<int> confirmationData;
-	std::map<int, Packet> udpSentPackets;
-	std::list<Packet> udpConfirmationPackets;
-	std::map<int, Packet> udpReceivedPackets;
+	Window<Packet> udpSentPackets;
+	Window<Packet> udpConfirmationPackets;
+	Window<Packet> udpReceivedPackets;
+	int udpSentFirstUnsentIndex;
+	int udpReceivedMaxIndex;
+	long long udpAddressChangeAllowedUs;
+	long long udpLastReceivedUs;
+	Address udpPendingAddress;
 
 	long long udpLastSentUs;
 	long long udpSendIntervalUs;
 	double udpSendIntervalUsFloat;
 
+	// place in calendar queue of server, replaces own timer of udp-writes
+	Pacer *pacer;
+	long long pacerTimeUs;
+	long long pacerTick;
+	int pacerIndex;
+
 	int udpSendMeasureIndex;
-	std::map<int, Measure> udpSendMeasures;
+	Window<Measure> udpSendMeasures;
 
 	Event eventTcpRead;
 	Event eventTcpWrite;
 	Event eventTcpClose;
-	Event eventUdpWrite;
 	Event eventUdpClose;
 	Event eventBuildUdpPackets;
 	Event eventBuildConfirmations;
@@ -122,6 +144,9 @@ public:
 		Socket &tcpSocket,
 		UdpListener &udpListener,
 		const Address &udpAddress,
+		unsigned int connectionId,
+		bool connectionIdNegotiated,
+		int tcpReceiveChunkSize,
 		int udpSendPacketSize,
 		int udpMaxSentBufferSize,
 		int udpMaxReceiveBufferSize,
@@ -142,18 +167,29 @@ public:
 	const std::string& getName() const { return name; }
 	UdpListener& getUdpListener() const { return *udpListener; }
 	const Address& getUdpAddress() const { return udpAddress; }
+	unsigned int getConnectionId() const { return connectionId; }
+	bool isConnectionIdNegotiated() const { return connectionIdNegotiated; }
+	// outgoing packets are tagged by id only when remote side knows it
+	unsigned int getSendConnectionId() const { return connectionIdNegotiated ? connectionId : 0; }
+	void setUdpAddress(const Address &udpAddress);
+	int getRemoteProtocolVersion() const { return remoteProtocolVersion; }
+	unsigned int getCapabilities() const { return capabilities; }
 
 private:
 	void tcpRead();
 	void tcpWrite(bool fake = false);
 
 public:
-	void udpRead(const Packet &packet);
+	void udpRead(Packet &packet, const Address &address);
+	void onUdpWritable();
+	void onUdpTransmitFailed(const Packet &packet);
 
 private:
+	void udpReadHello(const Packet &packet);
 	void udpWrite(long long plannedTimeUs);
 
 	void buildUdpPackets(bool flush);
+	void applyPendingSendPacketSize();
 	void buildConfirmations();
 	void buildByeBye();
 	void udpResend();
@@ -166,6 +202,7 @@ public:
 
 private:
 	bool isUdpFinished();
+	int getUdpMaxSentCount() const;
 	void onUdpSentBufferChanged(int sizeIncrement);
 	void onUdpSent(int measureIndex, long long intervalUs, int size);
 	void onUdpDelivered(bool success, int measureIndex, int size);
@@ -173,6 +210,8 @@ private:
 
 public:
 	long long getUdpSendIntervalUs() const { return udpSendIntervalUs; }
+	int getUdpSendPacketSize() const { return udpSendPacketSize; }
+	int getUdpReceiveBufferSize() const { return udpReceiveBufferSize; }
 };
 
 #endif
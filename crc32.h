@@ -0,0 +1,35 @@
+/*
+    ......... 2016 Ivan Mahonin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CRC32_H_
+#define _CRC32_H_
+
+
+// crc32 with non-reflected polynomial 0x04C11DB7,
+// all implementations produces the same result
+class Crc32 {
+public:
+	static unsigned int calc(const void *data, int size, unsigned int previousCrc32 = 0);
+
+	static unsigned int calcBytewise(const void *data, int size, unsigned int previousCrc32 = 0);
+	static unsigned int calcSlicing(const void *data, int size, unsigned int previousCrc32 = 0);
+	static unsigned int calcClmul(const void *data, int size, unsigned int previousCrc32 = 0);
+
+	static bool isClmulSupported();
+};
+
+#endif
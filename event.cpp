@@ -16,9 +16,9 @@
 */
 
 #include <cassert>
-#include <cstdlib>
 #include <cstring>
 
+#include <algorithm>
 #include <iostream>
 
 #include "event.h"
@@ -45,69 +45,131 @@ void Event::Source::setReady(bool value) {
 }
 
 
-Event::Manager::Manager():
-	listReady() { }
+Event::Manager::Manager(): raiseCounter(), nowUs(Platform::nowUs()) { }
 
 Event::Manager::~Manager() {
-	while(listReady) listReady->unlink();
+	for(HeapMap::iterator i = heaps.begin(); i != heaps.end(); ++i)
+		while(!i->second.empty()) i->second.back()->unlink();
 }
 
-long long Event::Manager::doEvents(long long timeUs) {
-	// get ready events
-	int count = 0;
-	int priority = 0;
-	Event *events = NULL;
-	for(Event *event = listReady; event; event = event->next[LinkReady]) {
-		if (event->getTime() <= timeUs) {
-			if (!events) priority = event->getPriority(); else
-				if (priority < event->getPriority()) priority = event->getPriority();
-			if (event->getPriority() == priority) {
-				event->link(LinkRaise, events);
-				++count;
-			}
-		}
+void Event::Manager::heapInsert(Event &event) {
+	Heap &heap = heaps[event.getPriority()];
+	event.heap = &heap;
+	event.heapIndex = (int)heap.size();
+	heap.push_back(&event);
+	heapSiftUp(heap, event.heapIndex);
+}
+
+void Event::Manager::heapRemove(Event &event) {
+	Heap &heap = *event.heap;
+	int index = event.heapIndex;
+	event.heap = NULL;
+	event.heapIndex = -1;
+
+	Event *last = heap.back();
+	heap.pop_back();
+	if (last != &event) {
+		heap[index] = last;
+		last->heapIndex = index;
+		heapSiftUp(heap, index);
+		heapSiftDown(heap, last->heapIndex);
 	}
+}
 
-	// skip non-priority
-	for(Event *event = events; event;)
-		if (event->getPriority() == priority) event = event->next[LinkRaise]; else {
-			Event *e = event;
-			event = event->next[LinkRaise];
-			e->unlink(LinkRaise);
-			--count;
-		}
+void Event::Manager::heapUpdate(Event &event) {
+	heapSiftUp(*event.heap, event.heapIndex);
+	heapSiftDown(*event.heap, event.heapIndex);
+}
 
-	// shuffle event before raise
-	shuffle.clear();
-	shuffle.resize(count);
-	for(Event *event = events; event;) {
-		Event *next = event->next[LinkRaise];
-		std::pair<Event*, Event*> &item = shuffle[rand()%shuffle.size()];
-		if (item.first == NULL) {
-			event->link(LinkRaise, item.first);
-			item.second = event;
-		} else
-		if (rand()%2) {
-			event->link(LinkRaise, item.first);
-		} else {
-			event->link(LinkRaise, item.second->next[LinkRaise]);
-			item.second = event;
-		}
-		event = next;
+void Event::Manager::heapSiftUp(Heap &heap, int index) {
+	Event *event = heap[index];
+	while(index > 0) {
+		int parent = (index - 1)/HeapArity;
+		if (heap[parent]->timeUs <= event->timeUs) break;
+		heap[index] = heap[parent];
+		heap[index]->heapIndex = index;
+		index = parent;
 	}
+	heap[index] = event;
+	event->heapIndex = index;
+}
 
-	assert(events == NULL);
-	while(events) events->unlink(LinkRaise);
+void Event::Manager::heapSiftDown(Heap &heap, int index) {
+	Event *event = heap[index];
+	int size = (int)heap.size();
+	while(true) {
+		int first = index*HeapArity + 1;
+		if (first >= size) break;
+		int last = std::min(first + HeapArity, size);
+		int child = first;
+		for(int i = first + 1; i < last; ++i)
+			if (heap[i]->timeUs < heap[child]->timeUs) child = i;
+		if (heap[child]->timeUs >= event->timeUs) break;
+		heap[index] = heap[child];
+		heap[index]->heapIndex = index;
+		index = child;
+	}
+	heap[index] = event;
+	event->heapIndex = index;
+}
 
-	Event **lastNext = &events;
-	for(std::vector< std::pair<Event*, Event*> >::iterator i = shuffle.begin(); i != shuffle.end(); ++i) {
-		if (i->first) {
-			*lastNext = i->first;
-			i->first->previousNext[LinkRaise] = lastNext;
-			lastNext = &i->second->next[LinkRaise];
+int Event::Manager::heapCollect(Heap &heap, int index, long long timeUs, Event *&events) {
+	// visit only subtrees with due root, so complexity is proportional to count of due events
+	if (index >= (int)heap.size() || heap[index]->timeUs > timeUs) return 0;
+	heap[index]->link(LinkRaise, events);
+	int count = 1;
+	int first = index*HeapArity + 1;
+	for(int i = first; i < first + HeapArity; ++i)
+		count += heapCollect(heap, i, timeUs, events);
+	return count;
+}
+
+Event* Event::Manager::sortByRaiseIndex(Event *events, int count) {
+	// stable merge sort of raise-list, only next-links are valid in result
+	if (count < 2) return events;
+	int half = count/2;
+	Event *second = events;
+	for(int i = 1; i < half; ++i) second = second->next[LinkRaise];
+	Event *tail = second;
+	second = second->next[LinkRaise];
+	tail->next[LinkRaise] = NULL;
+
+	Event *a = sortByRaiseIndex(events, half);
+	Event *b = sortByRaiseIndex(second, count - half);
+	Event *result = NULL;
+	Event **last = &result;
+	while(a && b) {
+		Event *&item = b->raiseIndex < a->raiseIndex ? b : a;
+		*last = item;
+		last = &item->next[LinkRaise];
+		item = item->next[LinkRaise];
+	}
+	*last = a ? a : b;
+	return result;
+}
+
+long long Event::Manager::updateNowUs()
+	{ return nowUs = Platform::nowUs(); }
+
+long long Event::Manager::doEvents(long long timeUs) {
+	nowUs = timeUs;
+
+	// get ready events with highest priority
+	int count = 0;
+	Event *events = NULL;
+	for(HeapMap::iterator i = heaps.begin(); i != heaps.end(); ++i) {
+		if (!i->second.empty() && i->second.front()->getTime() <= timeUs) {
+			count = heapCollect(i->second, 0, timeUs, events);
+			break;
 		}
 	}
 
+	// least recently raised events goes first,
+	// so all handlers with due events gets their turn in round-robin order
+	events = sortByRaiseIndex(events, count);
+	for(Event **previousNext = &events; *previousNext; previousNext = &(*previousNext)->next[LinkRaise])
+		(*previousNext)->previousNext[LinkRaise] = previousNext;
+
 	// raise
 	while(events) {
 		assert(events->getReady() && events->isEnabled());
@@ -115,20 +177,20 @@ long long Event::Manager::doEvents(long long timeUs) {
 	}
 
 	// find time of next event
-	if (listReady) {
-		long long nextTime = listReady->getTime();
-		for(Event *event = listReady; event; event = event->next[LinkReady])
-			if (event->getTime() < nextTime)
-				nextTime = event->getTime();
-		return nextTime;
-	}
-	return -1;
+	long long nextTime = -1;
+	for(HeapMap::iterator i = heaps.begin(); i != heaps.end(); ++i)
+		if (!i->second.empty() && (nextTime < 0 || i->second.front()->getTime() < nextTime))
+			nextTime = i->second.front()->getTime();
+	return nextTime;
 }
 
 
 Event::Event():
 	handler(),
 	manager(),
+	heap(),
+	heapIndex(-1),
+	raiseIndex(),
 	priority(),
 	timeUs(-1),
 	ready()
@@ -140,6 +202,9 @@ Event::Event():
 Event::Event(Handler &handler, Manager &manager, int priority):
 	handler(),
 	manager(),
+	heap(),
+	heapIndex(-1),
+	raiseIndex(),
 	timeUs(-1),
 	ready()
 {
@@ -151,6 +216,9 @@ Event::Event(Handler &handler, Manager &manager, int priority):
 Event::Event(Handler &handler, Manager &manager, Source &source, int priority):
 	handler(),
 	manager(),
+	heap(),
+	heapIndex(-1),
+	raiseIndex(),
 	priority(),
 	timeUs(-1),
 	ready()
@@ -182,6 +250,7 @@ void Event::unlink(LinkType type) {
 }
 
 void Event::unlink() {
+	if (heap) manager->heapRemove(*this);
 	for(int i = 0; i < LinkCount; ++i)
 		unlink((LinkType)i);
 	timeUs = -1;
@@ -209,15 +278,17 @@ void Event::init(Handler &handler, Manager &manager, Source &source, int priorit
 
 void Event::raise() {
 	long long plannedTimeUs = timeUs;
+	if (manager) raiseIndex = ++manager->raiseCounter;
 	disable();
 	if (handler) handler->handle(*this, plannedTimeUs);
 }
 
 void Event::updateReady() {
 	if (getReady() && isEnabled()) {
-		if (!previousNext[LinkReady] && manager) link(LinkReady, manager->listReady);
+		if (heap) manager->heapUpdate(*this); else
+			if (manager) manager->heapInsert(*this);
 	} else {
-		unlink(LinkReady);
+		if (heap) manager->heapRemove(*this);
 		unlink(LinkRaise);
 	}
 }
@@ -241,7 +312,7 @@ void Event::setTime(long long timeUs, bool force) {
 }
 
 void Event::setTimeRelativeNow(long long timeUs, bool force)
-	{ setTime(Platform::nowUs() + timeUs, force); }
+	{ setTime((manager ? manager->getNowUs() : Platform::nowUs()) + timeUs, force); }
 
 void Event::setTimeRelativePrev(long long timeUs, bool force) {
 	if (isEnabled())
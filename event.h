@@ -19,6 +19,7 @@
 #define _EVENT_H_
 
 
+#include <functional>
 #include <map>
 #include <vector>
 
@@ -26,12 +27,12 @@
 class Event {
 public:
 	enum LinkType {
-		LinkReady  = 0,
-		LinkRaise  = 1,
-		LinkSource = 2
+		LinkRaise  = 0,
+		LinkSource = 1
 	};
 	enum {
-		LinkCount  = 3
+		LinkCount  = 2,
+		HeapArity  = 4
 	};
 
 	class Handler {
@@ -55,12 +56,31 @@ public:
 	class Manager {
 	private:
 		friend class Event;
-		Event *listReady;
-		std::vector< std::pair<Event*, Event*> > shuffle;
+		typedef std::vector<Event*> Heap;
+		typedef std::map<int, Heap, std::greater<int> > HeapMap;
+
+		// ready and enabled events grouped by priority (highest first),
+		// each group is d-ary min-heap ordered by time
+		HeapMap heaps;
+		long long raiseCounter;
+		long long nowUs;
+
+		void heapInsert(Event &event);
+		void heapRemove(Event &event);
+		void heapUpdate(Event &event);
+		static void heapSiftUp(Heap &heap, int index);
+		static void heapSiftDown(Heap &heap, int index);
+		static int heapCollect(Heap &heap, int index, long long timeUs, Event *&events);
+		static Event* sortByRaiseIndex(Event *events, int count);
 	public:
 		Manager();
 		~Manager();
 		long long doEvents(long long timeUs);
+
+		// time of current iteration, cached by doEvents,
+		// updateNowUs makes fresh read of clock
+		long long getNowUs() const { return nowUs; }
+		long long updateNowUs();
 	};
 
 private:
@@ -69,6 +89,9 @@ private:
 
 	Event **previousNext[LinkCount];
 	Event *next[LinkCount];
+	Manager::Heap *heap;
+	int heapIndex;
+	long long raiseIndex;
 
 	int priority;
 	long long timeUs;
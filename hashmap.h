@@ -0,0 +1,155 @@
+/*
+    ......... 2016 Ivan Mahonin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _HASHMAP_H_
+#define _HASHMAP_H_
+
+#include <cstddef>
+
+#include <utility>
+#include <vector>
+
+
+// keys provides own hash() method, integers are mixed here
+template<typename K>
+struct HashMapHash {
+	size_t operator() (const K &key) const { return key.hash(); }
+};
+
+template<>
+struct HashMapHash<unsigned int> {
+	size_t operator() (unsigned int key) const {
+		unsigned long long h = key*0x9E3779B97F4A7C15ull;
+		return (size_t)(h ^ (h >> 32));
+	}
+};
+
+
+// hash map with open addressing (linear probing) in single array,
+// capacity is power of two and grows to keep at least half of slots free,
+// erase shifts following slots back, so there are no tombstones
+template<typename K, typename T, typename H = HashMapHash<K> >
+class HashMap {
+private:
+	struct Slot {
+		bool used;
+		K key;
+		T item;
+		Slot(): used(), key(), item() { }
+	};
+
+	std::vector<Slot> slots;
+	int mask;
+	int count;
+	H hasher;
+
+	int home(const K &key) const { return (int)(hasher(key) & (size_t)mask); }
+
+	int find(const K &key) const {
+		for(int i = home(key); slots[i].used; i = (i + 1) & mask)
+			if (slots[i].key == key) return i;
+		return -1;
+	}
+
+	void reserve(int size) {
+		if (2*size <= (int)slots.size()) return;
+		int capacity = (int)slots.size();
+		while(2*size > capacity) capacity *= 2;
+		std::vector<Slot> oldSlots(capacity);
+		oldSlots.swap(slots);
+		mask = capacity - 1;
+		for(typename std::vector<Slot>::iterator s = oldSlots.begin(); s != oldSlots.end(); ++s) {
+			if (!s->used) continue;
+			int i = home(s->key);
+			while(slots[i].used) i = (i + 1) & mask;
+			Slot &n = slots[i];
+			n.used = true;
+			std::swap(n.key, s->key);
+			std::swap(n.item, s->item);
+		}
+	}
+
+public:
+	explicit HashMap(int capacity = 16):
+		mask(), count()
+	{
+		int size = 2;
+		while(size < capacity) size *= 2;
+		slots.resize(size);
+		mask = size - 1;
+	}
+
+	int getCount() const { return count; }
+	int getCapacity() const { return (int)slots.size(); }
+	bool empty() const { return count <= 0; }
+
+	T* get(const K &key) {
+		int i = find(key);
+		return i < 0 ? NULL : &slots[i].item;
+	}
+
+	const T* get(const K &key) const {
+		int i = find(key);
+		return i < 0 ? NULL : &slots[i].item;
+	}
+
+	// returns existing item or new default one
+	T& insert(const K &key) {
+		int i = find(key);
+		if (i >= 0) return slots[i].item;
+		reserve(count + 1);
+		i = home(key);
+		while(slots[i].used) i = (i + 1) & mask;
+		Slot &s = slots[i];
+		s.used = true;
+		s.key = key;
+		++count;
+		return s.item;
+	}
+
+	void erase(const K &key) {
+		int i = find(key);
+		if (i < 0) return;
+		for(int j = i; ; ) {
+			slots[i].used = false;
+			slots[i].item = T();
+
+			// find next slot which may be moved into hole at i,
+			// slot stays when its home position is cyclically in (i, j]
+			int h;
+			do {
+				j = (j + 1) & mask;
+				if (!slots[j].used) { --count; return; }
+				h = home(slots[j].key);
+			} while(i <= j ? i < h && h <= j : i < h || h <= j);
+
+			Slot &s = slots[i];
+			s.used = true;
+			std::swap(s.key, slots[j].key);
+			std::swap(s.item, slots[j].item);
+			i = j;
+		}
+	}
+
+	void clear() {
+		for(typename std::vector<Slot>::iterator s = slots.begin(); s != slots.end(); ++s)
+			if (s->used) { s->used = false; s->item = T(); }
+		count = 0;
+	}
+};
+
+#endif
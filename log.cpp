@@ -19,6 +19,8 @@
 #include <cstring>
 #include <ctime>
 
+#include <mutex>
+
 #include "log.h"
 #include "platform.h"
 
@@ -60,6 +62,10 @@ void Log::logLine(Type type, const std::string &name, const std::string &line) {
 		"error"
 	};
 
+	// logs of worker threads share streams, gmtime shares buffer
+	static std::mutex mutex;
+	std::lock_guard<std::mutex> lock(mutex);
+
 	time_t rawtime;
 	struct tm *ptm;
 	time(&rawtime);
@@ -18,6 +18,7 @@
 #include <cstring>
 #include <cstdlib>
 
+#include <algorithm>
 #include <string>
 #include <sstream>
 #include <vector>
@@ -81,6 +82,11 @@ namespace params {
 		return true;
 	}
 
+	bool tcp_receive_chunk_size(Server &server, char **args) {
+		server.tcpReceiveChunkSize = atoi(args[1]);
+		return true;
+	}
+
 	bool udp_receive_packet_size(Server &server, char **args) {
 		server.udpReceivePacketSize = atoi(args[1]);
 		return true;
@@ -91,9 +97,48 @@ namespace params {
 		return true;
 	}
 
+	bool udp_receive_batch_size(Server &server, char **args) {
+		server.udpReceiveBatchSize = atoi(args[1]);
+		return true;
+	}
+
+	bool udp_segmentation_offload(Server &server, char **) {
+		server.udpSegmentationOffload = true;
+		return true;
+	}
+
+	bool udp_receive_offload(Server &server, char **) {
+		server.udpReceiveOffload = true;
+		return true;
+	}
+
+	bool tcp_listener_udp_sockets(Server &server, char **args) {
+		server.tcpListenerUdpSockets = atoi(args[1]);
+		return server.tcpListenerUdpSockets >= 0;
+	}
+
+	bool threads(Server &server, char **args) {
+		server.threads = atoi(args[1]);
+		return server.threads > 0;
+	}
+
+	bool workers(Server &server, char **args) {
+		server.processes = atoi(args[1]);
+		return server.processes > 0;
+	}
+
+	bool socket_backend(Server &server, char **args) {
+		std::string backend = args[1];
+		if (backend == "poll")
+			return server.socketGroup.setBackend(Socket::Group::BackendPoll);
+		if (backend == "uring")
+			return server.socketGroup.setBackend(Socket::Group::BackendUring);
+		return false;
+	}
+
 	bool udp_send_packet_size(Server &server, char **args) {
 		server.udpSendPacketSize = atoi(args[1]);
-		return true;
+		return server.udpSendPacketSize >= Packet::MinPacketSize;
 	}
 
 	bool udp_max_sent_buffer_size(Server &server, char **args) {
@@ -151,6 +196,31 @@ namespace params {
 		return true;
 	}
 
+	bool udp_address_change_us(Server &server, char **args) {
+		server.udpAddressChangeUs = atoll(args[1]);
+		return true;
+	}
+
+	bool packet_pool_size(Server &server, char **args) {
+		server.packetPoolSize = atoi(args[1]);
+		return true;
+	}
+
+	bool event_drain_budget(Server &server, char **args) {
+		server.eventDrainBudget = atoi(args[1]);
+		return true;
+	}
+
+	bool udp_pacer_tick_us(Server &server, char **args) {
+		server.udpPacerTickUs = atoll(args[1]);
+		return true;
+	}
+
+	bool udp_pacer_burst(Server &server, char **args) {
+		server.udpPacerBurst = atoi(args[1]);
+		return true;
+	}
+
 	bool udp_listener(Server &server, char **args) {
 		Address udpAddress;
 		Address tcpAddress;
@@ -190,9 +260,13 @@ namespace params {
 		PARAM1(test_udp_remote_address, "<address>", "address of remote udp-tunnel to test-listener"),
 		PARAM1(tcp_backlog, "<value>", "backlog parameter for listen() function"),
 		PARAM1(tcp_receive_address_size, "<value>", "maximum size of tcp-address data"),
+		PARAM1(tcp_receive_chunk_size, "<value>", "maximum size of data read from tcp-socket at once, limited by free space of send buffer"),
 		PARAM1(udp_receive_packet_size, "<value>", "size of buffer to receive single udp-packet"),
 		PARAM1(udp_receive_address_size, "<value>", "maximum size of udp-address data"),
-		PARAM1(udp_send_packet_size, "<value>", "size of sent udp-packets"),
+		PARAM1(udp_receive_batch_size, "<value>", "maximum count of udp-packets received at once by single system call"),
+		PARAM0(udp_segmentation_offload, "send consecutive udp-packets of same size to same address by single datagram split by kernel (UDP_SEGMENT), falls back to separate datagrams when not supported"),
+		PARAM0(udp_receive_offload, "let kernel coalesce received udp-packets of same flow (UDP_GRO), they will be split back before processing"),
+		PARAM1(udp_send_packet_size, "<value>", "size of sent udp-packets, at least 64, remote side may propose smaller one"),
 		PARAM1(udp_max_sent_buffer_size, "<value>", "size of send buffer per connection"),
 		PARAM1(udp_max_receive_buffer_size, "<value>", "size of receive buffer connection"),
 		PARAM1(udp_max_sent_measure_size, "<value>", "amount of transfered data to do single speed measure"),
@@ -204,6 +278,15 @@ namespace params {
 		PARAM1(build_confirmations_us, "<value>", "interval in microseconds of send confirmations"),
 		PARAM1(build_udp_packets_us, "<value>", "time in microseconds of awaiting data from tcp before send non-full udp-packet"),
 		PARAM1(udp_max_sent_measure_us, "<value>", "time in microseconds to do single speed measure"),
+		PARAM1(udp_address_change_us, "<value>", "minimal time in microseconds between changes of remote udp-address of connection, address changes only by packet with index not received yet or with new confirmations"),
+		PARAM1(packet_pool_size, "<value>", "count of packet buffers allocated at start, see 'packet buffers' in statistics to choose value"),
+		PARAM1(event_drain_budget, "<value>", "maximum count of passes over due events before polling sockets, see 'poll calls' in statistics to choose value"),
+		PARAM1(udp_pacer_tick_us, "<value>", "time in microseconds of single tick of pacer which releases udp-packets of all connections in batches"),
+		PARAM1(udp_pacer_burst, "<value>", "count of udp-packets which late connection may send to catch up its rate, the rest of delay is forgiven"),
+		PARAM1(tcp_listener_udp_sockets, "<value>", "count of udp-sockets shared by all connections of each tcp-listener, connections are told apart by id in packets (remote side should support it), zero means own udp-socket per connection (default)"),
+		PARAM1(socket_backend, "<poll|uring>", "system interface for socket events: poll (epoll, default) or uring (io_uring with multishot requests, linux 5.19 and newer)"),
+		PARAM1(threads, "<value>", "count of threads with own event loops, tcp-connections and udp-flows are distributed between them by kernel (SO_REUSEPORT)"),
+		PARAM1(workers, "<value>", "count of processes started by fork, they share ports of listeners (SO_REUSEPORT), udp-flows are steered between them by hash of source address or by connection id, so flow keeps its worker when remote address changes (linux only)"),
 		PARAM2(udp_listener, "<from>", "<to>", "server-side of tunnel forward all incoming udp-connections to specified tcp-address"),
 		PARAM2(tcp_listener, "<from>", "<to>", "client-side of tunnel forward all incoming tcp-connections to specified address of udp-listener"),
 		PARAM1(test_listener, "<address>", "simple server uses to do some tests, see: --test-tcp-remote-address, --test-tcp-remote-address"),
@@ -295,6 +378,14 @@ bool init(Server &server, int argc, char **argv) {
 	return server.test || !server.tcpListeners.empty() || !server.udpListeners.empty() || !server.testListeners.empty();
 }
 
+int initWorkers(int argc, char **argv) {
+	// processes forked before server created, so scan for param directly
+	for(int i = 1; i + 1 < argc; ++i)
+		if (std::string(argv[i]) == "--workers")
+			return std::max(1, atoi(argv[i + 1]));
+	return 1;
+}
+
 int main(int argc, char **argv) {
 	Socket::initialize();
 	int r = Platform::main(argc, argv);
@@ -21,5 +21,6 @@
 struct Server;
 
 bool init(Server &server, int argc, char **argv);
+int initWorkers(int argc, char **argv);
 
 #endif
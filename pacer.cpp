@@ -0,0 +1,166 @@
+/*
+    ......... 2016 Ivan Mahonin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+
+#include <algorithm>
+
+#include "pacer.h"
+
+#include "connection.h"
+
+
+Pacer::Pacer(Event::Manager &manager, int priority, long long tickUs, int burst):
+	slots(SlotsCount),
+	tickUs(tickUs > 0 ? tickUs : 1),
+	currentTick(manager.getNowUs()/this->tickUs),
+	burst(),
+	count(),
+	event(*this, manager, priority)
+{
+	memset(occupied, 0, sizeof(occupied));
+	setBurst(burst);
+}
+
+Pacer::~Pacer() {
+	for(std::vector< std::vector<Connection*> >::iterator i = slots.begin(); i != slots.end(); ++i)
+		for(std::vector<Connection*>::iterator j = i->begin(); j != i->end(); ++j)
+			(*j)->pacerTimeUs = -1;
+}
+
+void Pacer::insert(Connection &connection, long long timeUs) {
+	long long tick = std::max(timeUs/tickUs, currentTick);
+	int index = (int)(tick & (SlotsCount - 1));
+	std::vector<Connection*> &slot = slots[index];
+	occupied[index/WordBits] |= 1ull << (index%WordBits);
+	connection.pacerTimeUs = timeUs;
+	connection.pacerTick = tick;
+	connection.pacerIndex = (int)slot.size();
+	slot.push_back(&connection);
+	++count;
+	event.setTime(tick*tickUs);
+}
+
+void Pacer::remove(Connection &connection) {
+	int index = (int)(connection.pacerTick & (SlotsCount - 1));
+	std::vector<Connection*> &slot = slots[index];
+	Connection *last = slot.back();
+	slot[connection.pacerIndex] = last;
+	last->pacerIndex = connection.pacerIndex;
+	slot.pop_back();
+	if (slot.empty())
+		occupied[index/WordBits] &= ~(1ull << (index%WordBits));
+	connection.pacerTimeUs = -1;
+	--count;
+}
+
+long long Pacer::findOccupied(long long tick, long long endTick) const {
+	// first tick of range with non-empty slot, or endTick
+	while(tick < endTick) {
+		int index = (int)(tick & (SlotsCount - 1));
+		unsigned long long word = occupied[index/WordBits] >> (index%WordBits);
+		if (word) return std::min(tick + __builtin_ctzll(word), endTick);
+		tick += WordBits - index%WordBits;
+	}
+	return endTick;
+}
+
+long long Pacer::getNextTimeUs() const {
+	if (count <= 0) return -1;
+
+	// slot contains connections of its own tick or of later turns of ring
+	long long minTick = -1;
+	long long endTick = currentTick + SlotsCount;
+	for(long long tick = findOccupied(currentTick, endTick); tick < endTick; tick = findOccupied(tick + 1, endTick)) {
+		const std::vector<Connection*> &slot = slots[tick & (SlotsCount - 1)];
+		for(std::vector<Connection*>::const_iterator i = slot.begin(); i != slot.end(); ++i) {
+			if ((*i)->pacerTick == tick) return tick*tickUs;
+			if (minTick < 0 || (*i)->pacerTick < minTick) minTick = (*i)->pacerTick;
+		}
+	}
+	return minTick*tickUs;
+}
+
+void Pacer::handle(Event& /* event */, long long /* plannedTimeUs */) {
+	long long nowUs = event.getManager()->getNowUs();
+	long long nowTick = nowUs/tickUs;
+	if (nowTick >= currentTick) {
+		long long endTick = std::min(nowTick + 1, currentTick + SlotsCount);
+		for(long long tick = findOccupied(currentTick, endTick); tick < endTick; tick = findOccupied(tick + 1, endTick)) {
+			std::vector<Connection*> &slot = slots[tick & (SlotsCount - 1)];
+			for(int i = 0; i < (int)slot.size(); ) {
+				Connection &connection = *slot[i];
+				if (connection.pacerTick > nowTick) { ++i; continue; }
+				processing.push_back(Item(&connection, connection.pacerTimeUs));
+				remove(connection);
+			}
+		}
+		currentTick = nowTick + 1;
+	}
+
+	// connection re-plans itself after each packet
+	long long endUs = currentTick*tickUs;
+	for(std::vector<Item>::iterator i = processing.begin(); i != processing.end(); ++i) {
+		Connection &connection = *i->connection;
+		long long timeUs = std::max(i->timeUs, nowUs - burst*connection.udpSendIntervalUs);
+		while(true) {
+			connection.udpWrite(timeUs);
+			if (connection.pacerTimeUs < 0 || connection.pacerTimeUs >= endUs) break;
+			timeUs = connection.pacerTimeUs;
+			remove(connection);
+		}
+	}
+	processing.clear();
+
+	event.setTime(getNextTimeUs(), true);
+}
+
+void Pacer::schedule(Connection &connection, long long timeUs) {
+	if (timeUs < 0) return;
+	if (isScheduled(connection)) {
+		if (connection.pacerTimeUs <= timeUs) return;
+		remove(connection);
+	}
+	insert(connection, timeUs);
+}
+
+void Pacer::cancel(Connection &connection)
+	{ if (isScheduled(connection)) remove(connection); }
+
+bool Pacer::isScheduled(const Connection &connection) const
+	{ return connection.pacerTimeUs >= 0; }
+
+void Pacer::setTickUs(long long tickUs) {
+	if (tickUs < 1) tickUs = 1;
+	if (this->tickUs == tickUs) return;
+
+	for(std::vector< std::vector<Connection*> >::iterator i = slots.begin(); i != slots.end(); ++i) {
+		for(std::vector<Connection*>::iterator j = i->begin(); j != i->end(); ++j)
+			processing.push_back(Item(*j, (*j)->pacerTimeUs));
+		i->clear();
+	}
+	memset(occupied, 0, sizeof(occupied));
+	count = 0;
+	currentTick = currentTick*this->tickUs/tickUs;
+	this->tickUs = tickUs;
+
+	for(std::vector<Item>::iterator i = processing.begin(); i != processing.end(); ++i)
+		insert(*i->connection, i->timeUs);
+	processing.clear();
+
+	event.setTime(getNextTimeUs(), true);
+}
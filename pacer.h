@@ -0,0 +1,88 @@
+/*
+    ......... 2016 Ivan Mahonin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _PACER_H_
+#define _PACER_H_
+
+#include <vector>
+
+#include "event.h"
+
+
+class Connection;
+
+// calendar queue of connections waiting for time to send next udp-packet,
+// ring of slots tickUs wide, connection planned beyond the ring waits
+// in its slot for later turn, single event is raised once per tick for all
+// due connections, each one sends all packets planned inside current tick,
+// late connection keeps credit of burst packets only (token bucket),
+// so event manager holds one timer instead of timer per connection,
+// bitmap of non-empty slots lets search skip empty ones a word at once,
+// so cost of pacing follows count of sent packets
+class Pacer: public Event::Handler {
+public:
+	enum {
+		SlotsCount = 1024,
+		WordBits = 64,
+		WordsCount = SlotsCount/WordBits
+	};
+
+private:
+	struct Item {
+		Connection *connection;
+		long long timeUs;
+		Item(): connection(), timeUs() { }
+		Item(Connection *connection, long long timeUs):
+			connection(connection), timeUs(timeUs) { }
+	};
+
+	std::vector< std::vector<Connection*> > slots;
+	unsigned long long occupied[WordsCount];
+	std::vector<Item> processing;
+	long long tickUs;
+	long long currentTick;
+	int burst;
+	int count;
+	Event event;
+
+	Pacer(const Pacer&);
+	Pacer& operator=(const Pacer&);
+
+	void insert(Connection &connection, long long timeUs);
+	void remove(Connection &connection);
+	long long findOccupied(long long tick, long long endTick) const;
+	long long getNextTimeUs() const;
+
+public:
+	Pacer(Event::Manager &manager, int priority, long long tickUs, int burst);
+	~Pacer();
+
+	void handle(Event &event, long long plannedTimeUs);
+
+	// as Event::setTime, earlier time wins
+	void schedule(Connection &connection, long long timeUs);
+	void cancel(Connection &connection);
+	bool isScheduled(const Connection &connection) const;
+
+	void setTickUs(long long tickUs);
+	long long getTickUs() const { return tickUs; }
+	void setBurst(int burst) { this->burst = burst > 0 ? burst : 0; }
+	int getBurst() const { return burst; }
+	int getCount() const { return count; }
+};
+
+#endif
@@ -19,6 +19,7 @@
 #define _PACKET_H_
 
 #include <vector>
+#include <algorithm>
 
 class Packet {
 public:
@@ -32,6 +33,41 @@ public:
 		                //   signal that no more "data" packets will be sent
 		                //   no more hello, bye, data or disconnect
 	};
+	enum {
+		HeaderSize = 9,
+		ConnectionIdSize = 4,
+		ConnectionIdFlag = 0x80,        // bit of type field, packet ends with connection id
+		MinPacketSize = 64,             // smallest payload size, fits hello and several confirmation ranges
+		ProtocolVersion = 1,
+		CapabilityConnectionId = 1,     // packets may be tagged by connection id
+		Capabilities = CapabilityConnectionId   // bit flags of optional protocol features supported by this build
+	};
+
+	// recycles buffers of fixed size (slabs),
+	// packets which fits into slab takes buffer from pool instead of heap
+	class Pool {
+	private:
+		int slabSize;
+		int liveCount;
+		std::vector<char*> freeSlabs;
+
+		Pool(const Pool&);
+		Pool& operator=(const Pool&);
+
+	public:
+		explicit Pool(int slabSize = 0);
+		~Pool();
+
+		void setSlabSize(int slabSize);
+		void reserve(int count);
+
+		char* alloc();
+		void release(char *slab, int size);
+
+		int getSlabSize() const { return slabSize; }
+		int getLiveCount() const { return liveCount; }
+		int getFreeCount() const { return (int)freeSlabs.size(); }
+	};
 
 	bool sent;
 	long long sentTimeUs;
@@ -39,62 +75,105 @@ public:
 	int remainResendCount;
 	bool confirmed;
 
-	std::vector<char> data;
+private:
+	Pool *pool;
+	char *buffer;
+	int capacity;
+	int rawSize;
+	bool pooled;
 
+	void reserve(int size);
+	void release();
+	void setConnectionId(unsigned int connectionId);
+
+public:
 	Packet():
 		sent(),
 		sentTimeUs(),
 		measureIndex(),
 		remainResendCount(),
-		confirmed()
-	{ data.reserve(12); }
+		confirmed(),
+		pool(),
+		buffer(),
+		capacity(),
+		rawSize(),
+		pooled()
+	{ }
+
+	Packet(const Packet &other);
+	Packet(Packet &&other) noexcept;
+	~Packet() { release(); }
+
+	Packet& operator=(const Packet &other);
+	Packet& operator=(Packet &&other) noexcept;
+
+	void setPool(Pool *pool) { this->pool = pool; }
+	Pool* getPool() const { return pool; }
 
 	bool isComplete() const
 		{ return sent && confirmed; }
 
 	template<typename T>
 	const T get(int offset) const {
-		return offset >= 0 && offset + (int)sizeof(T) <= (int)data.size()
-			 ? *(const T*)&data[offset] : T();
+		return offset >= 0 && offset + (int)sizeof(T) <= rawSize
+			 ? *(const T*)(buffer + offset) : T();
 	}
 
 	template<typename T>
 	void set(int offset, const T &value) {
 		if (offset < 0) return;
-		if ((int)data.size() < offset + (int)sizeof(T))
-			data.resize(offset + (int)sizeof(T));
-		*(T*)&data[offset] = value;
+		if (rawSize < offset + (int)sizeof(T))
+			setRawSize(offset + (int)sizeof(T));
+		*(T*)(buffer + offset) = value;
 	}
 
 	unsigned int getCrc32() const { return get<unsigned int>(0); }
 	void setCrc32(unsigned int value) { set<unsigned int>(0, value); }
 
 	Type getType() const
-		{ return (Type)get<unsigned char>(4); }
+		{ return (Type)(get<unsigned char>(4) & ~ConnectionIdFlag); }
 	void setType(Type value)
 		{ set<unsigned char>(4, value); }
 
 	int getIndex() const { return get<unsigned int>(5); }
 	void setIndex(int value) { set<unsigned int>(5, value); }
 
-	const void* getData() const { return (int)data.size() > 9 ? &data[9] : NULL; }
-	int getSize() const { return (int)data.size() > 9 ? (int)data.size() - 9 : 0; }
+	// connection id allows several connections to share same pair of udp-addresses,
+	// it placed after data, so payload stays at same offset
+	bool hasConnectionId() const
+		{ return (get<unsigned char>(4) & ConnectionIdFlag) && rawSize >= HeaderSize + ConnectionIdSize; }
+	unsigned int getConnectionId() const
+		{ return hasConnectionId() ? get<unsigned int>(rawSize - ConnectionIdSize) : 0; }
+
+	int getSize() const
+		{ return std::max(0, rawSize - HeaderSize - (hasConnectionId() ? (int)ConnectionIdSize : 0)); }
+	const void* getData() const { return getSize() ? buffer + HeaderSize : NULL; }
 	void setData(const void *data, int size);
 
-	void* getRawData() { return data.empty() ? NULL : &data.front(); }
-	const void* getRawData() const { return data.empty() ? NULL : &data.front(); }
-	int getRawSize() const { return (int)data.size(); }
+	void* getRawData() { return rawSize ? buffer : NULL; }
+	const void* getRawData() const { return rawSize ? buffer : NULL; }
+	int getRawSize() const { return rawSize; }
 	void setRawData(const void *data, int size);
 	void setRawSize(int size) { setRawData(NULL, size); }
 
-	void encode(Type type, int index, const void *data = NULL, int size = 0);
+	// zero connection id means untagged packet
+	void encode(Type type, int index, const void *data = NULL, int size = 0, unsigned int connectionId = 0);
+
+	// hello packet carries version, capabilities and parameters of sender,
+	// new versions only appends fields, missing fields reads as zero,
+	// so hello without payload from old peer means version 0 without any capabilities
+	void encodeHello(int index, unsigned int capabilities, int packetSize, unsigned int helloConnectionId, unsigned int connectionId = 0);
+	int getHelloVersion() const { return getSize() >= 1 ? get<unsigned char>(HeaderSize) : 0; }
+	unsigned int getHelloCapabilities() const { return getSize() >= 5 ? get<unsigned int>(HeaderSize + 1) : 0; }
+	int getHelloPacketSize() const { return getSize() >= 9 ? get<unsigned int>(HeaderSize + 5) : 0; }
+	unsigned int getHelloConnectionId() const { return getSize() >= 13 ? get<unsigned int>(HeaderSize + 9) : 0; }
 
 	static unsigned int crc32(const void *data, int size, unsigned int previousCrc32 = 0);
 
 	void applyCrc32()
-		{ setCrc32(crc32(&data[4], data.size() - 4)); }
+		{ setCrc32(crc32(buffer + 4, rawSize - 4)); }
 	bool checkCrc32()
-		{ return getCrc32() == crc32(&data[4], data.size() - 4); }
+		{ return rawSize >= 4 && getCrc32() == crc32(buffer + 4, rawSize - 4); }
 
 	static bool checkCrc32(const void *data, int size)
 		{ return size > 4 && *(unsigned int*)data == crc32((const char*)data + 4, size - 4); }
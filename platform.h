@@ -27,6 +27,7 @@ class Platform {
 private:
 	class Internal;
 public:
+	// monotonic time, not related to wall-clock
 	static long long nowUs();
 	static int lastError();
 	static std::string lastErrorString(int err);
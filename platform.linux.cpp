@@ -16,8 +16,15 @@
 */
 
 #include <cerrno>
+#include <csignal>
+#include <cstdio>
 
-#include <sys/time.h>
+#include <vector>
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
 
 #include "platform.h"
 #include "main.h"
@@ -29,10 +36,10 @@ class Platform::Internal { };
 
 
 long long Platform::nowUs() {
-	timeval tp;
+	timespec tp;
 	memset(&tp, 0, sizeof(tp));
-	gettimeofday(&tp, NULL);
-	return 1000000ll*(long long)tp.tv_sec + (long long)tp.tv_usec;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return 1000000ll*(long long)tp.tv_sec + (long long)tp.tv_nsec/1000;
 }
 
 int Platform::lastError() {
@@ -44,8 +51,35 @@ std::string Platform::lastErrorString(int err) {
 }
 
 int Platform::main(int argc, char **argv) {
-	Server server("main");
-	if (init(server, argc, argv))
-		server.run();
+	// every worker process parses params and opens own listeners,
+	// so fork before any socket or epoll instance created
+	std::string name = "main";
+	std::vector<pid_t> children;
+	int workers = initWorkers(argc, argv);
+	for(int i = 1; i < workers; ++i) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			break;
+		}
+		if (pid == 0) {
+			prctl(PR_SET_PDEATHSIG, SIGTERM);
+			name = Log::strprintf("worker%d", i);
+			children.clear();
+			break;
+		}
+		children.push_back(pid);
+	}
+
+	{
+		Server server(name);
+		if (init(server, argc, argv)) {
+			if (name != "main") server.test = false;
+			server.run();
+		}
+	}
+
+	for(std::vector<pid_t>::const_iterator i = children.begin(); i != children.end(); ++i)
+		waitpid(*i, NULL, 0);
 	return 0;
 }
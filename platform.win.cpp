@@ -74,13 +74,16 @@ SERVICE_STATUS_HANDLE Platform::Internal::Service::statusHandle;
 
 
 long long Platform::nowUs() {
-	FILETIME ft;
-	memset(&ft, 0, sizeof(ft));
-	GetSystemTimeAsFileTime(&ft);
-	long long t = ((long long)ft.dwHighDateTime << 32) | (long long)ft.dwLowDateTime;
-	t /= 10;
-    t -= 11644473600000000ll;
-    return t;
+	static long long frequency = 0;
+	if (!frequency) {
+		LARGE_INTEGER f;
+		QueryPerformanceFrequency(&f);
+		frequency = f.QuadPart;
+	}
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	long long t = counter.QuadPart;
+	return t/frequency*1000000ll + t%frequency*1000000ll/frequency;
 }
 
 int Platform::lastError() {
@@ -16,6 +16,9 @@
 */
 
 #include <cmath>
+#include <cstring>
+
+#include <algorithm>
 
 #include "server.h"
 #include "platform.h"
@@ -47,6 +50,8 @@ TcpListener::TcpListener(
 	eventClose(*this, server.eventManager, socket.sourceClose)
 {
 	server.log.info(name, "open");
+	if (server.isPortShared())
+		socket.setReusePort(true);
 	socket.bind(tcpAddress);
 	socket.listen(backlog);
 	eventRead.setTimeRelativeNow();
@@ -61,8 +66,11 @@ void TcpListener::handle(Event &event, long long) {
 			#ifdef LOG_CONECTIONS
 			server->log.info(name, "received tcp-connection from %s", client->getAddressRemote().toString().c_str());
 			#endif
-			UdpListener *udpListener = server->createUdpListener(Address(), Address());
-			if (!udpListener || !server->createConnection(*client, *udpListener, udpAddress)) {
+			// connections at shared socket are told apart by id from first packet,
+			// own socket uses id only when remote side confirms it in hello
+			bool shared = server->tcpListenerUdpSockets > 0;
+			UdpListener *udpListener = shared ? chooseUdpListener() : server->createUdpListener(Address(), Address());
+			if (!udpListener || !server->createConnection(*client, *udpListener, udpAddress, udpListener->createConnectionId(), shared)) {
 				server->log.info(name, "tcp-connection from %s cancelled", client->getAddressRemote().toString().c_str());
 				delete client;
 			}
@@ -74,90 +82,341 @@ void TcpListener::handle(Event &event, long long) {
 	}
 }
 
+UdpListener* TcpListener::chooseUdpListener() {
+	// fill pool first, so connections spreads over sockets (and over workers of remote side),
+	// then choose socket with fewest connections
+	if ((int)udpListeners.size() < server->tcpListenerUdpSockets) {
+		UdpListener *udpListener = server->createUdpListener(Address(), Address());
+		udpListener->owner = this;
+		udpListeners.push_back(udpListener);
+		return udpListener;
+	}
+	UdpListener *udpListener = NULL;
+	for(std::vector<UdpListener*>::iterator i = udpListeners.begin(); i != udpListeners.end(); ++i)
+		if (!udpListener || (*i)->getConnectionsCount() < udpListener->getConnectionsCount())
+			udpListener = *i;
+	return udpListener;
+}
+
+void TcpListener::detachUdpListener(UdpListener &udpListener) {
+	std::vector<UdpListener*>::iterator i = std::find(udpListeners.begin(), udpListeners.end(), &udpListener);
+	if (i != udpListeners.end()) udpListeners.erase(i);
+	udpListener.owner = NULL;
+}
+
 UdpListener::UdpListener(
 	Server &server,
 	const std::string &name,
 	const Address &udpAddress,
 	const Address &tcpAddress,
 	int receivePacketSize,
-	int receiveAddressSize
+	int receiveAddressSize,
+	int receiveBatchSize
 ):
 	server(&server),
 	name(name),
 	socket(server.socketGroup, name + "(socket)", Socket::UDP, receiveAddressSize),
 	tcpAddress(tcpAddress),
-	eventRead(*this, server.eventManager, socket.sourceRead, tcpAddress.data.empty() ? 0 : 1),
+	eventRead(*this, server.eventManager, socket.sourceRead, tcpAddress.empty() ? 0 : 1),
+	eventWrite(*this, server.eventManager, socket.sourceWrite, tcpAddress.empty() ? 0 : 1),
 	eventClose(*this, server.eventManager, socket.sourceClose),
 	lastTcpSocketIndex(),
-	receivePacketSize(receivePacketSize)
+	connectionIdRandom(std::random_device()()),
+	steeringCount(1),
+	receivePacketSize(receivePacketSize),
+	receiveBatchSize(std::max(1, std::min((int)Socket::MaxBuffers, receiveBatchSize))),
+	receiveTails(),
+	receiveTailsSize(),
+	connectionsCount(),
+	owner()
 {
 	#ifdef LOG_CONECTIONS
 	server.log.info(name, "open");
 	#else
-	if (!tcpAddress.data.empty()) server.log.info(name, "open");
+	if (!tcpAddress.empty()) server.log.info(name, "open");
 	#endif
 
-	if (!udpAddress.data.empty())
+	receivePackets.resize(this->receiveBatchSize);
+	receiveAddresses.resize(this->receiveBatchSize);
+	receiveSizes.resize(this->receiveBatchSize);
+	receiveSegmentSizes.resize(this->receiveBatchSize);
+	for(std::vector<Packet>::iterator i = receivePackets.begin(); i != receivePackets.end(); ++i)
+		i->setPool(&server.packetPool);
+	receiveSegment.setPool(&server.packetPool);
+
+	if (server.udpSegmentationOffload)
+		socket.setSegmentation(true);
+	if (server.udpReceiveOffload)
+		socket.setReceiveOffload(true);
+	if (!udpAddress.empty()) {
+		if (server.isPortShared())
+			socket.setReusePort(true);
 		socket.bind(udpAddress);
+		if (server.isPortShared() && socket.setReusePortSteering(server.getPortSharersCount()))
+			steeringCount = server.getPortSharersCount();
+	}
 	eventRead.setTimeRelativeNow();
 	eventClose.setTimeRelativeNow();
 }
 
+UdpListener::~UdpListener()
+	{ delete[] receiveTails; }
+
 void UdpListener::handle(Event &event, long long) {
 	if (&event == &eventRead) {
-		receivePacket.setRawSize(receivePacketSize);
-		int size = socket.readfrom(receivePacket.getRawData(), receiveAddress, receivePacket.getRawSize());
+		// read batch into slabs of packet pool, rare bigger packets
+		// and datagrams coalesced by kernel continues in receiveTails
+		int slabSize = server->packetPool.getSlabSize();
+		int tailSize = std::max(0, std::min(receivePacketSize, (int)Socket::MaxDatagramSize) - slabSize);
+		if (receiveTailsSize < tailSize*receiveBatchSize) {
+			delete[] receiveTails;
+			receiveTailsSize = tailSize*receiveBatchSize;
+			receiveTails = new char[receiveTailsSize];
+		}
+
+		void *buffers[Socket::MaxBuffers];
+		void *tails[Socket::MaxBuffers];
+		int sizes[Socket::MaxBuffers];
+		for(int i = 0; i < receiveBatchSize; ++i) {
+			receivePackets[i].setRawSize(slabSize);
+			slabSize = receivePackets[i].getRawSize();
+			buffers[i] = receivePackets[i].getRawData();
+			sizes[i] = slabSize;
+			tails[i] = tailSize > 0 ? &receiveTails[tailSize*i] : NULL;
+		}
+
+		int count = socket.readfrom(
+			buffers,
+			sizes,
+			tailSize > 0 ? tails : NULL,
+			tailSize,
+			&receiveAddresses.front(),
+			&receiveSizes.front(),
+			receiveBatchSize,
+			&receiveSegmentSizes.front() );
 		eventRead.setTimeRelativeNow();
 
-		if (size >= 0 && !receiveAddress.data.empty()) {
+		for(int i = 0; i < count; ++i) {
+			if (receiveAddresses[i].empty()) continue;
+			Packet &packet = receivePackets[i];
+			int size = receiveSizes[i];
 			server->statUdpReceived += size;
-			receivePacket.setRawSize(size);
-			if (!receivePacket.checkCrc32()) {
-				#ifdef DUMP_UDP_RECV_BAD_PACKETS
-				std::cout << "[" << name << " received bad udp-packet, size " << receivePacket.getRawSize() << "]" << std::endl;
-				#endif
-			} else {
-				Connection *connection = connectionByAddress(receiveAddress);
-				if (!tcpAddress.data.empty() && !connection) {
-					bool isDataPacketType = false;
-					switch(receivePacket.getType()) {
-					case Packet::Hello:
-					case Packet::Bye:
-					case Packet::Data:
-					case Packet::Disconnect:
-						isDataPacketType = true;
-						break;
-					default:
-						break;
-					}
-
-					if (isDataPacketType) {
-						std::string clientName = Log::strprintf("%s(tcpSocket%d)", name.c_str(), ++lastTcpSocketIndex);
-						Socket *client = new Socket(server->socketGroup, clientName, Socket::TCP, socket.getReceiveAddressSize());
-						client->connect(tcpAddress);
-						connection = server->createConnection(*client, *this, receiveAddress);
-					}
+			size = std::min(size, sizes[i] + tailSize);
+
+			// split train of datagrams coalesced by kernel
+			int segmentSize = receiveSegmentSizes[i];
+			if (segmentSize > 0 && segmentSize < size) {
+				for(int offset = 0; offset < size; offset += segmentSize) {
+					int segment = std::min(segmentSize, size - offset);
+					receiveSegment.setRawSize(segment);
+					char *dst = (char*)receiveSegment.getRawData();
+					int fromSlab = std::max(0, std::min(segment, sizes[i] - offset));
+					if (fromSlab > 0)
+						memcpy(dst, (const char*)packet.getRawData() + offset, fromSlab);
+					if (segment > fromSlab)
+						memcpy(dst + fromSlab, (const char*)tails[i] + offset + fromSlab - sizes[i], segment - fromSlab);
+					receive(receiveSegment, receiveAddresses[i]);
 				}
-				if (connection)
-					connection->udpRead(receivePacket);
+				continue;
 			}
+
+			packet.setRawSize(size);
+			if (size > sizes[i])
+				memcpy((char*)packet.getRawData() + sizes[i], tails[i], size - sizes[i]);
+			receive(packet, receiveAddresses[i]);
 		}
 	} else
+	if (&event == &eventWrite) {
+		writeQueueProcessing.swap(writeQueue);
+		for(std::vector<Connection*>::iterator i = writeQueueProcessing.begin(); i != writeQueueProcessing.end(); ++i)
+			(*i)->onUdpWritable();
+		writeQueueProcessing.clear();
+	} else
 	if (&event == &eventClose) {
-		if (connections.empty()) {
+		if (!connectionsCount) {
 			#ifdef LOG_CONECTIONS
 			server->log.info(name, "close");
 			#else
-			if (!tcpAddress.data.empty()) server->log.info(name, "close");
+			if (!tcpAddress.empty()) server->log.info(name, "close");
 			#endif
 			server->onUdpListenerClosed(*this, socket.wasError());
 		}
 	}
 }
 
+void UdpListener::receive(Packet &packet, const Address &address) {
+	if (!packet.checkCrc32()) {
+		#ifdef DUMP_UDP_RECV_BAD_PACKETS
+		std::cout << "[" << name << " received bad udp-packet, size " << packet.getRawSize() << "]" << std::endl;
+		#endif
+		return;
+	}
+
+	Connection *connection = NULL;
+	if (packet.hasConnectionId()) {
+		// remote side may change address (NAT rebinding), connection follows it
+		// and keeps its state including measured speed, see Connection::udpRead
+		connection = connectionById(packet.getConnectionId());
+	} else {
+		connection = connectionByAddress(address);
+	}
+
+	if (!tcpAddress.empty() && !connection) {
+		bool isDataPacketType = false;
+		switch(packet.getType()) {
+		case Packet::Hello:
+		case Packet::Bye:
+		case Packet::Data:
+		case Packet::Disconnect:
+			isDataPacketType = true;
+			break;
+		default:
+			break;
+		}
+
+		if (isDataPacketType) {
+			std::string clientName = Log::strprintf("%s(tcpSocket%d)", name.c_str(), ++lastTcpSocketIndex);
+			Socket *client = new Socket(server->socketGroup, clientName, Socket::TCP, socket.getReceiveAddressSize());
+			client->connect(tcpAddress);
+			connection = server->createConnection(*client, *this, address, packet.getConnectionId(), packet.hasConnectionId());
+		}
+	}
+	if (connection)
+		connection->udpRead(packet, address);
+}
+
 Connection* UdpListener::connectionByAddress(const Address &udpAddress) {
-	std::map<Address, Connection*>::const_iterator i = connections.find(udpAddress);
-	return i == connections.end() ? NULL : i->second;
+	Connection **c = connectionsByAddress.get(udpAddress);
+	return c ? *c : NULL;
+}
+
+Connection* UdpListener::connectionById(unsigned int connectionId) {
+	Connection **c = connectionsById.get(connectionId);
+	return c ? *c : NULL;
+}
+
+unsigned int UdpListener::createConnectionId() {
+	// random ids, so ids of different clients rarely meet at remote side,
+	// and late packets of closed connection does not get into new one
+	unsigned int connectionId;
+	do { connectionId = connectionIdRandom(); } while(!connectionId || connectionById(connectionId));
+	return connectionId;
+}
+
+unsigned int UdpListener::createConnectionId(const Address &udpAddress) {
+	unsigned int connectionId;
+	do { connectionId = createConnectionId(); } while(!isSteeredTogether(connectionId, udpAddress));
+	return connectionId;
+}
+
+bool UdpListener::isSteeredTogether(unsigned int connectionId, const Address &udpAddress) const {
+	return steeringCount <= 1
+	    || Socket::getSteeringIndex(connectionId, steeringCount) == Socket::getSteeringIndex(udpAddress, steeringCount);
+}
+
+void UdpListener::addConnection(Connection &connection) {
+	if (!connection.isConnectionIdNegotiated())
+		connectionsByAddress.insert(connection.getUdpAddress()) = &connection;
+	if (connection.getConnectionId())
+		connectionsById.insert(connection.getConnectionId()) = &connection;
+	++connectionsCount;
+}
+
+void UdpListener::removeConnection(Connection &connection) {
+	if (connectionByAddress(connection.getUdpAddress()) == &connection)
+		connectionsByAddress.erase(connection.getUdpAddress());
+	removeConnectionId(connection);
+	--connectionsCount;
+}
+
+bool UdpListener::addConnectionId(Connection &connection) {
+	Connection *&c = connectionsById.insert(connection.getConnectionId());
+	if (c && c != &connection) return false;
+	c = &connection;
+	return true;
+}
+
+void UdpListener::removeConnectionId(Connection &connection) {
+	if (connectionById(connection.getConnectionId()) == &connection)
+		connectionsById.erase(connection.getConnectionId());
+}
+
+void UdpListener::onConnectionAddressChanged(Connection &connection, const Address &prevUdpAddress) {
+	// untagged packets (sent before negotiation) should find connection at new address too
+	if (connectionByAddress(prevUdpAddress) != &connection) return;
+	connectionsByAddress.erase(prevUdpAddress);
+	Connection *&c = connectionsByAddress.insert(connection.getUdpAddress());
+	if (!c) c = &connection;
+}
+
+void UdpListener::waitWrite(Connection &connection) {
+	writeQueue.push_back(&connection);
+	eventWrite.setTimeRelativeNow();
+}
+
+void UdpListener::cancelWaitWrite(Connection &connection) {
+	std::vector<Connection*>::iterator i = std::find(writeQueue.begin(), writeQueue.end(), &connection);
+	if (i != writeQueue.end()) writeQueue.erase(i);
+}
+
+void UdpListener::transmit(Connection &connection, const Packet &packet) {
+	if (transmitQueue.empty()) server->udpTransmitListeners.push_back(this);
+	transmitQueue.push_back(TransmitItem());
+	transmitQueue.back().connection = &connection;
+	transmitQueue.back().packet = packet;
+}
+
+void UdpListener::transmit(Connection &connection, Packet &&packet) {
+	if (transmitQueue.empty()) server->udpTransmitListeners.push_back(this);
+	transmitQueue.push_back(TransmitItem());
+	transmitQueue.back().connection = &connection;
+	transmitQueue.back().packet = std::move(packet);
+}
+
+void UdpListener::cancelTransmit(Connection &connection) {
+	for(std::vector<TransmitItem>::iterator i = transmitQueue.begin(); i != transmitQueue.end(); ++i)
+		if (i->connection == &connection) i->connection = NULL;
+}
+
+void UdpListener::flush() {
+	const void *data[Socket::MaxBuffers];
+	int sizes[Socket::MaxBuffers];
+	const Address *addresses[Socket::MaxBuffers];
+	int resultSizes[Socket::MaxBuffers];
+	TransmitItem *items[Socket::MaxBuffers];
+
+	std::vector<TransmitItem>::iterator i = transmitQueue.begin();
+	bool busy = false;
+	while(i != transmitQueue.end() && !busy) {
+		int count = 0;
+		for(; i != transmitQueue.end() && count < Socket::MaxBuffers; ++i) {
+			if (!i->connection) continue;
+			items[count] = &*i;
+			data[count] = i->packet.getRawData();
+			sizes[count] = i->packet.getRawSize();
+			addresses[count] = &i->connection->getUdpAddress();
+			++count;
+		}
+		if (!count) break;
+
+		int sent = socket.writeto(data, sizes, addresses, resultSizes, count, name);
+		for(int j = 0; j < sent; ++j) {
+			server->statUdpSent += resultSizes[j];
+			if (resultSizes[j] != sizes[j])
+				server->log.warning(items[j]->connection->getName(), "udp-packet sent truncated %d/%d", resultSizes[j], sizes[j]);
+		}
+
+		// socket is busy, report rest of datagrams back to connections
+		if (sent < count) {
+			busy = true;
+			for(int j = sent; j < count; ++j)
+				items[j]->connection->onUdpTransmitFailed(items[j]->packet);
+		}
+	}
+	for(; i != transmitQueue.end(); ++i)
+		if (i->connection) i->connection->onUdpTransmitFailed(i->packet);
+
+	transmitQueue.clear();
 }
 
 
@@ -167,8 +426,13 @@ Server::Server(const std::string &name):
 	test(),
 	tcpBacklog(1024),
 	tcpReceiveAddressSize(1024),
+	tcpReceiveChunkSize(64*1024),
 	udpReceivePacketSize(1024*1024),
 	udpReceiveAddressSize(1024),
+	udpReceiveBatchSize(32),
+	udpSegmentationOffload(),
+	udpReceiveOffload(),
+	tcpListenerUdpSockets(),
 	udpSendPacketSize(1024), // (1460),
 	udpMaxSentBufferSize(8*1024*1024),
 	udpMaxReceiveBufferSize(8*1024*1024),
@@ -181,6 +445,13 @@ Server::Server(const std::string &name):
 	buildConfirmationsUs(100000),
 	buildUdpPacketsUs(100000),
 	udpMaxSentMeasureUs(1000000),
+	udpAddressChangeUs(1000000),
+	packetPoolSize(),
+	eventDrainBudget(16),
+	udpPacerTickUs(50),
+	udpPacerBurst(1),
+	threads(1),
+	processes(1),
 	udpSummaryConnectionsSendIntervalUs(),
 	statTcpSent(),
 	statTcpReceived(),
@@ -189,15 +460,63 @@ Server::Server(const std::string &name):
 	statUdpReceivedExtra(),
 	statCpuWorkUs(),
 	statCpuSleepUs(),
+	statPollCalls(),
+	statPollCount(),
+	statPollOversleepUs(),
+	statPollOversleepMaxUs(),
 	statLastMeasureUs(Platform::nowUs()),
-	socketGroup(name + "(socketGroup)", log)
+	socketGroup(name + "(socketGroup)", log),
+	udpPacer(eventManager, 0, udpPacerTickUs, udpPacerBurst),
+	udpPriorityPacer(eventManager, 1, udpPacerTickUs, udpPacerBurst),
+	parent(),
+	index(),
+	stopping()
 {
 	log.streams[Log::Info]    = &std::cout;
 	log.streams[Log::Warning] = &std::cerr;
 	log.streams[Log::Error]   = &std::cerr;
 }
 
+Server::Server(Server &parent, int index):
+	Server(Log::strprintf("%s(worker%d)", parent.name.c_str(), index))
+{
+	this->parent = &parent;
+	this->index = index;
+	memcpy(log.streams, parent.log.streams, sizeof(log.streams));
+	socketGroup.setBackend(parent.socketGroup.getBackend());
+
+	tcpBacklog = parent.tcpBacklog;
+	tcpReceiveAddressSize = parent.tcpReceiveAddressSize;
+	tcpReceiveChunkSize = parent.tcpReceiveChunkSize;
+	udpReceivePacketSize = parent.udpReceivePacketSize;
+	udpReceiveAddressSize = parent.udpReceiveAddressSize;
+	udpReceiveBatchSize = parent.udpReceiveBatchSize;
+	udpSegmentationOffload = parent.udpSegmentationOffload;
+	udpReceiveOffload = parent.udpReceiveOffload;
+	tcpListenerUdpSockets = parent.tcpListenerUdpSockets;
+	udpSendPacketSize = parent.udpSendPacketSize;
+	udpMaxSentBufferSize = parent.udpMaxSentBufferSize;
+	udpMaxReceiveBufferSize = parent.udpMaxReceiveBufferSize;
+	udpMaxSentMeasureSize = parent.udpMaxSentMeasureSize;
+	udpResendCount = parent.udpResendCount;
+	confirmationResendCount = parent.confirmationResendCount;
+	udpMaxSendLossPercent = parent.udpMaxSendLossPercent;
+	udpInitialSendIntervalUs = parent.udpInitialSendIntervalUs;
+	udpResendUs = parent.udpResendUs;
+	buildConfirmationsUs = parent.buildConfirmationsUs;
+	buildUdpPacketsUs = parent.buildUdpPacketsUs;
+	udpMaxSentMeasureUs = parent.udpMaxSentMeasureUs;
+	udpAddressChangeUs = parent.udpAddressChangeUs;
+	packetPoolSize = parent.packetPoolSize;
+	eventDrainBudget = parent.eventDrainBudget;
+	udpPacerTickUs = parent.udpPacerTickUs;
+	udpPacerBurst = parent.udpPacerBurst;
+	threads = parent.threads;
+	processes = parent.processes;
+}
+
 Server::~Server() {
+	stopWorkers();
 	while(!connections.empty())
 		onConnectionClosed(**connections.begin());
 	while(!tcpListeners.empty())
@@ -214,10 +533,17 @@ void Server::onTcpListenerClosed(TcpListener &tcpListener, bool error) {
 	Address tcpAddress = tcpListener.getTcpAddress();
 	Address udpAddress = tcpListener.getUdpAddress();
 
+	// shared udp-listeners live until their last connection closed
+	std::vector<UdpListener*> sharedUdpListeners = tcpListener.getUdpListeners();
+	for(std::vector<UdpListener*>::iterator i = sharedUdpListeners.begin(); i != sharedUdpListeners.end(); ++i) {
+		tcpListener.detachUdpListener(**i);
+		if (!(*i)->getConnectionsCount()) onUdpListenerClosed(**i);
+	}
+
 	tcpListeners.erase(&tcpListener);
 	delete &tcpListener;
 
-	if (error && !udpAddress.data.empty())
+	if (error && !udpAddress.empty())
 		createTcpListener(tcpAddress, udpAddress);
 }
 
@@ -225,37 +551,54 @@ void Server::onUdpListenerClosed(UdpListener &udpListener, bool error) {
 	#ifdef LOG_CONECTIONS
 	log.info(udpListener.getName(), "close");
 	#else
-	if (!udpListener.getTcpAddress().data.empty()) log.info(udpListener.getName(), "close");
+	if (!udpListener.getTcpAddress().empty()) log.info(udpListener.getName(), "close");
 	#endif
 
 	Address udpAddress = udpListener.getUdpAddress();
 	Address tcpAddress = udpListener.getTcpAddress();
 
+	if (udpListener.owner)
+		udpListener.owner->detachUdpListener(udpListener);
 	udpListeners.erase(&udpListener);
+	std::vector<UdpListener*>::iterator i = std::find(udpTransmitListeners.begin(), udpTransmitListeners.end(), &udpListener);
+	if (i != udpTransmitListeners.end()) udpTransmitListeners.erase(i);
 	delete &udpListener;
 
-	if (error && !tcpAddress.data.empty())
+	if (error && !tcpAddress.empty())
 		createUdpListener(udpAddress, tcpAddress);
 }
 
+void Server::udpFlush() {
+	for(std::vector<UdpListener*>::iterator i = udpTransmitListeners.begin(); i != udpTransmitListeners.end(); ++i)
+		(*i)->flush();
+	udpTransmitListeners.clear();
+}
+
 void Server::onConnectionClosed(Connection &connection) {
 	#ifdef LOG_CONECTIONS
 	log.info(connection.getName(), "close");
 	#endif
 
 	UdpListener &udpListener = connection.getUdpListener();
-	std::map<Address, Connection*>::iterator i = udpListener.connections.find(connection.getUdpAddress());
-	if (i != udpListener.connections.end() && i->second == &connection)
-		udpListener.connections.erase(i);
+	udpListener.removeConnection(connection);
 	connections.erase(&connection);
 	delete &connection;
 
-	if (udpListener.getTcpAddress().data.empty())
+	// shared socket of tcp-listener stays open for next connections
+	if ( udpListener.getTcpAddress().empty()
+	  && !udpListener.getConnectionsCount()
+	  && (!udpListener.owner || udpListener.getSocket().sourceClose.getReady()) )
 		onUdpListenerClosed(udpListener);
 }
 
+std::string Server::createObjectIndex() {
+	// objects of workers numbered separately
+	return parent ? Log::strprintf("#%d.%d", index, ++lastObjectIndex)
+	              : Log::strprintf("#%d", ++lastObjectIndex);
+}
+
 TcpListener* Server::createTcpListener(const Address &tcpAddress, const Address &udpAddress) {
-	std::string name = Log::strprintf("#%d tcp-listener %s -> %s", ++lastObjectIndex, tcpAddress.toString().c_str(), udpAddress.toString().c_str());
+	std::string name = Log::strprintf("%s tcp-listener %s -> %s", createObjectIndex().c_str(), tcpAddress.toString().c_str(), udpAddress.toString().c_str());
 	TcpListener *tcpListener = new TcpListener(
 		*this,
 		name,
@@ -268,20 +611,21 @@ TcpListener* Server::createTcpListener(const Address &tcpAddress, const Address
 }
 
 UdpListener* Server::createUdpListener(const Address &udpAddress, const Address &tcpAddress) {
-	std::string name = Log::strprintf("#%d udp-listener %s -> %s", ++lastObjectIndex, udpAddress.toString().c_str(), tcpAddress.toString().c_str());
+	std::string name = Log::strprintf("%s udp-listener %s -> %s", createObjectIndex().c_str(), udpAddress.toString().c_str(), tcpAddress.toString().c_str());
 	UdpListener *udpListener = new UdpListener(
 		*this,
 		name,
 		udpAddress,
 		tcpAddress,
 		udpReceivePacketSize,
-		udpReceiveAddressSize );
+		udpReceiveAddressSize,
+		udpReceiveBatchSize );
 	udpListeners.insert(udpListener);
 	return udpListener;
 }
 
 BenchmarkTcpServer* Server::createTestListener(const Address &tcpAddress) {
-	std::string name = Log::strprintf("#%d test-listener %s", ++lastObjectIndex, tcpAddress.toString().c_str());
+	std::string name = Log::strprintf("%s test-listener %s", createObjectIndex().c_str(), tcpAddress.toString().c_str());
 	BenchmarkTcpServer *testListener = new BenchmarkTcpServer(
 		socketGroup,
 		eventManager,
@@ -319,18 +663,29 @@ double Server::getUdpInitialSpeed() const {
 	return 1000000.0*(double)udpSendPacketSize/(double)getUdpInitialIntervalUs();
 }
 
-Connection* Server::createConnection(Socket &tcpSocket, UdpListener &udpListener, const Address &udpAddress) {
-	std::string shortName = Log::strprintf("#%d", ++lastObjectIndex);
+Connection* Server::createConnection(
+	Socket &tcpSocket,
+	UdpListener &udpListener,
+	const Address &udpAddress,
+	unsigned int connectionId,
+	bool connectionIdNegotiated )
+{
+	std::string shortName = createObjectIndex();
 	std::string name = Log::strprintf("%s connection %s <-> %s", shortName.c_str(), tcpSocket.getAddressRemote().toString().c_str(), udpAddress.toString().c_str());
+	if (connectionIdNegotiated) name += Log::strprintf(" id %u", connectionId);
 
 	#ifdef LOG_CONECTIONS
 	log.info(name, "opening");
 	#endif
 
-	if (Connection *c = udpListener.connectionByAddress(udpAddress)) {
+	if (Connection *c = connectionIdNegotiated ? NULL : udpListener.connectionByAddress(udpAddress)) {
 		log.warning("already exists connection with same udp address (%s)", c->getName().c_str());
 		return NULL;
 	}
+	if (Connection *c = connectionId ? udpListener.connectionById(connectionId) : NULL) {
+		log.warning("already exists connection with same id (%s)", c->getName().c_str());
+		return NULL;
+	}
 
 	Connection *connection = new Connection(
 		*this,
@@ -339,6 +694,9 @@ Connection* Server::createConnection(Socket &tcpSocket, UdpListener &udpListener
 		tcpSocket,
 		udpListener,
 		udpAddress,
+		connectionId,
+		connectionIdNegotiated,
+		tcpReceiveChunkSize,
 		udpSendPacketSize,
 		udpMaxSentBufferSize,
 		udpMaxReceiveBufferSize,
@@ -352,23 +710,184 @@ Connection* Server::createConnection(Socket &tcpSocket, UdpListener &udpListener
 		buildUdpPacketsUs,
 		udpMaxSentMeasureUs );
 	connections.insert(connection);
-	udpListener.connections[udpAddress] = connection;
+	udpListener.addConnection(*connection);
 	return connection;
 }
 
+void Server::Statistics::clear() {
+	tcpSent = 0;
+	tcpReceived = 0;
+	udpSent = 0;
+	udpReceived = 0;
+	udpReceivedExtra = 0;
+	cpuWorkUs = 0;
+	cpuSleepUs = 0;
+	pollCalls = 0;
+	pollCount = 0;
+	pollOversleepUs = 0;
+	pollOversleepMaxUs = 0;
+	packetsLive = 0;
+	packetsFree = 0;
+	connections = 0;
+	speedSum = 0.0;
+	speedSqrSum = 0.0;
+	speedMin = 0.0;
+	speedMax = 0.0;
+}
+
+void Server::Statistics::add(const Statistics &other) {
+	tcpSent += other.tcpSent;
+	tcpReceived += other.tcpReceived;
+	udpSent += other.udpSent;
+	udpReceived += other.udpReceived;
+	udpReceivedExtra += other.udpReceivedExtra;
+	cpuWorkUs += other.cpuWorkUs;
+	cpuSleepUs += other.cpuSleepUs;
+	pollCalls += other.pollCalls;
+	pollCount += other.pollCount;
+	pollOversleepUs += other.pollOversleepUs;
+	pollOversleepMaxUs = std::max(pollOversleepMaxUs, other.pollOversleepMaxUs);
+	packetsLive += other.packetsLive;
+	packetsFree += other.packetsFree;
+	if (other.connections) {
+		speedMin = connections ? std::min(speedMin, other.speedMin) : other.speedMin;
+		speedMax = connections ? std::max(speedMax, other.speedMax) : other.speedMax;
+	}
+	connections += other.connections;
+	speedSum += other.speedSum;
+	speedSqrSum += other.speedSqrSum;
+}
+
+void Server::collectStatistics(Statistics &statistics) {
+	statistics.clear();
+	statistics.tcpSent = statTcpSent;
+	statistics.tcpReceived = statTcpReceived;
+	statistics.udpSent = statUdpSent;
+	statistics.udpReceived = statUdpReceived;
+	statistics.udpReceivedExtra = statUdpReceivedExtra;
+	statistics.cpuWorkUs = statCpuWorkUs;
+	statistics.cpuSleepUs = statCpuSleepUs;
+	statistics.pollCalls = statPollCalls;
+	statistics.pollCount = statPollCount;
+	statistics.pollOversleepUs = statPollOversleepUs;
+	statistics.pollOversleepMaxUs = statPollOversleepMaxUs;
+	statistics.packetsLive = packetPool.getLiveCount();
+	statistics.packetsFree = packetPool.getFreeCount();
+
+	for(std::set<Connection*>::const_iterator i = connections.begin(); i != connections.end(); ++i)
+		if (!(*i)->isNoMoreDataWillBeSent()) {
+			double speed = 1000000.0*(double)udpSendPacketSize/std::max(10ll, (*i)->getUdpSendIntervalUs());
+			if (!statistics.connections || statistics.speedMin > speed) statistics.speedMin = speed;
+			if (!statistics.connections || statistics.speedMax < speed) statistics.speedMax = speed;
+			statistics.speedSum += speed;
+			statistics.speedSqrSum += speed*speed;
+			++statistics.connections;
+		}
+
+	statCpuWorkUs = 0;
+	statCpuSleepUs = 0;
+	statPollCalls = 0;
+	statPollCount = 0;
+	statPollOversleepUs = 0;
+	statPollOversleepMaxUs = 0;
+	statTcpSent = 0;
+	statTcpReceived = 0;
+	statUdpSent = 0;
+	statUdpReceived = 0;
+	statUdpReceivedExtra = 0;
+}
+
+void Server::logStatistics(const Statistics &statistics, double dt) {
+	const Statistics &s = statistics;
+	double cpuLoading = s.cpuWorkUs + s.cpuSleepUs ? (double)s.cpuWorkUs/(double)(s.cpuWorkUs + s.cpuSleepUs) : 0.0;
+
+	log.info(name,
+		"cpu %f%%, threads %d, tcp send %fKB/s, tcp receive %fKB/s, udp send %fKB/s, udp receive %fKB/s, udp overhead %fKB/s",
+		100.0*cpuLoading,
+		(int)workers.size() + 1,
+		(double)s.tcpSent/dt/1024.0,
+		(double)s.tcpReceived/dt/1024.0,
+		(double)s.udpSent/dt/1024.0,
+		(double)s.udpReceived/dt/1024.0,
+		(double)s.udpReceivedExtra/dt/1024.0 );
+
+	log.info(name,
+		"poll calls %lld, waits %lld, oversleep avg %lldus, max %lldus",
+		s.pollCalls,
+		s.pollCount,
+		s.pollCount ? s.pollOversleepUs/s.pollCount : 0ll,
+		s.pollOversleepMaxUs );
+
+	log.info(name,
+		"packet buffers live %d, free %d",
+		s.packetsLive,
+		s.packetsFree );
+
+	double avgSpeed = s.connections ? s.speedSum/(double)s.connections : 0.0;
+	double avgDeviation = s.connections ? ::sqrt(std::max(0.0, s.speedSqrSum/(double)s.connections - avgSpeed*avgSpeed)) : 0.0;
+	log.info(name,
+		"connections %d, initial speed %fKB/s, avg %fKB/s, min %fKB/s, max %fKB/s, deviation %fKB/s",
+		s.connections,
+		getUdpInitialSpeed()/1024.0,
+		avgSpeed/1024.0,
+		s.speedMin/1024.0,
+		s.speedMax/1024.0,
+		avgDeviation/1024.0 );
+}
+
 void Server::run(long long stepUs) {
 	begin();
 	while(step(stepUs));
 	end();
 }
 
+void Server::runWorker() {
+	// short steps to notice stopping
+	while(!stopping && step(100000));
+	log.info(name, "stop");
+}
+
 void Server::begin() {
 	if (test) {
 		log.info(name, "'test' flag is set");
 		TestLauncher::launchAll(log, testTcpRemoteAddress, testUdpRemoteAddress);
 		test = false;
 	}
+	packetPool.setSlabSize(udpSendPacketSize + Packet::HeaderSize + Packet::ConnectionIdSize);
+	packetPool.reserve(packetPoolSize);
+	udpPacer.setTickUs(udpPacerTickUs);
+	udpPacer.setBurst(udpPacerBurst);
+	udpPriorityPacer.setTickUs(udpPacerTickUs);
+	udpPriorityPacer.setBurst(udpPacerBurst);
 	log.info(name, "start");
+
+	// workers repeat listeners of main server, kernel distributes
+	// incoming tcp-connections and udp-flows between them
+	if (!parent && workers.empty()) {
+		for(int i = 1; i < threads; ++i) {
+			Server *worker = new Server(*this, i);
+			for(std::set<TcpListener*>::const_iterator j = tcpListeners.begin(); j != tcpListeners.end(); ++j)
+				worker->createTcpListener((*j)->getTcpAddress(), (*j)->getUdpAddress());
+			for(std::set<UdpListener*>::const_iterator j = udpListeners.begin(); j != udpListeners.end(); ++j)
+				if (!(*j)->getTcpAddress().empty())
+					worker->createUdpListener((*j)->getUdpAddress(), (*j)->getTcpAddress());
+			worker->begin();
+			workers.push_back(worker);
+		}
+		for(std::vector<Server*>::const_iterator i = workers.begin(); i != workers.end(); ++i)
+			workerThreads.push_back(std::thread(&Server::runWorker, *i));
+	}
+}
+
+void Server::stopWorkers() {
+	for(std::vector<Server*>::const_iterator i = workers.begin(); i != workers.end(); ++i)
+		(*i)->stopping = true;
+	for(std::vector<std::thread>::iterator i = workerThreads.begin(); i != workerThreads.end(); ++i)
+		i->join();
+	workerThreads.clear();
+	for(std::vector<Server*>::const_iterator i = workers.begin(); i != workers.end(); ++i)
+		delete *i;
+	workers.clear();
 }
 
 bool Server::stepWhile(long long durationUs, bool force) {
@@ -384,8 +903,20 @@ bool Server::stepWhile(long long durationUs, bool force) {
 }
 
 bool Server::step(long long stepUs) {
-	long long beginUs = Platform::nowUs();
+	long long beginUs = eventManager.updateNowUs();
 	long long nextUs = eventManager.doEvents(beginUs);
+
+	// handlers often re-arm itself for now, so raise them again instead of extra poll,
+	// poll without waiting when budget exhausted
+	for(int i = 1; i < eventDrainBudget && nextUs >= 0; ++i) {
+		long long timeUs = eventManager.updateNowUs();
+		if (nextUs > timeUs) break;
+		nextUs = eventManager.doEvents(timeUs);
+	}
+
+	// send all datagrams collected while raising events
+	udpFlush();
+
 	if (nextUs < 0 || nextUs > beginUs + stepUs)
 		nextUs = beginUs + stepUs;
 	long long pollBeginUs = Platform::nowUs();
@@ -398,65 +929,29 @@ bool Server::step(long long stepUs) {
 	long long actualDurationUs = std::min(durationUs, pollEndUs - pollBeginUs);
 	statCpuWorkUs += endUs - beginUs - actualDurationUs;
 	statCpuSleepUs += actualDurationUs;
+	++statPollCalls;
+	if (durationUs > 0) {
+		long long oversleepUs = std::max(0ll, pollEndUs - nextUs);
+		++statPollCount;
+		statPollOversleepUs += oversleepUs;
+		statPollOversleepMaxUs = std::max(statPollOversleepMaxUs, oversleepUs);
+	}
 	if (statLastMeasureUs + 2000000ll <= pollEndUs) {
-		long long dtUs = pollEndUs - statLastMeasureUs;
-		double dt = 0.000001*(double)dtUs;
-
-		double cpuLoading = (double)(statCpuWorkUs)/(double)(statCpuWorkUs + statCpuSleepUs);
-		double tcpSend = (double)statTcpSent/dt;
-		double tcpReceive = (double)statTcpReceived/dt;
-		double udpSend = (double)statUdpSent/dt;
-		double udpReceive = (double)statUdpReceived/dt;
-		double udpReceiveExtra = (double)statUdpReceivedExtra/dt;
-
-		log.info(name,
-			"cpu %f%%, tcp send %fKB/s, tcp receive %fKB/s, udp send %fKB/s, udp receive %fKB/s, udp overhead %fKB/s",
-			100.0*cpuLoading,
-			tcpSend/1024.0,
-			tcpReceive/1024.0,
-			udpSend/1024.0,
-			udpReceive/1024.0,
-			udpReceiveExtra/1024.0 );
-
-		int count = 0;
-		double minSpeed = 0.0;
-		double maxSpeed = 0.0;
-		double sumSpeed = 0.0;
-		for(std::set<Connection*>::const_iterator i = connections.begin(); i != connections.end(); ++i)
-			if (!(*i)->isNoMoreDataWillBeSent()) {
-				double speed = 1000000.0*(double)udpSendPacketSize/std::max(10ll, (*i)->getUdpSendIntervalUs());
-				if (count == 0 || minSpeed > speed) minSpeed = speed;
-				if (count == 0 || maxSpeed < speed) maxSpeed = speed;
-				sumSpeed += speed;
-				++count;
+		double dt = 0.000001*(double)(pollEndUs - statLastMeasureUs);
+		Statistics statistics;
+		collectStatistics(statistics);
+		if (parent) {
+			std::lock_guard<std::mutex> lock(parent->statisticsMutex);
+			parent->workerStatistics.add(statistics);
+		} else {
+			{
+				std::lock_guard<std::mutex> lock(statisticsMutex);
+				statistics.add(workerStatistics);
+				workerStatistics.clear();
 			}
-		double avgSpeed = count ? sumSpeed/(double)count : 0.0;
-
-		double sumSqrDeviation = 0.0;
-		for(std::set<Connection*>::const_iterator i = connections.begin(); i != connections.end(); ++i)
-			if (!(*i)->isNoMoreDataWillBeSent()) {
-				double speed = 1000000.0*(double)udpSendPacketSize/std::max(10ll, (*i)->getUdpSendIntervalUs());
-				sumSqrDeviation += (speed - avgSpeed)*(speed - avgSpeed);
-			}
-		double avgDeviation = count ? ::sqrt(sumSqrDeviation/(double)count) : 0;
-
-		log.info(name,
-			"connections %d, initial speed %fKB/s, avg %fKB/s, min %fKB/s, max %fKB/s, deviation %fKB/s",
-			count,
-			getUdpInitialSpeed()/1024.0,
-			avgSpeed/1024.0,
-			minSpeed/1024.0,
-			maxSpeed/1024.0,
-			avgDeviation/1024.0 );
-
+			logStatistics(statistics, dt);
+		}
 		statLastMeasureUs = pollEndUs;
-		statCpuWorkUs = 0;
-		statCpuSleepUs = 0;
-		statTcpSent = 0;
-		statTcpReceived = 0;
-		statUdpSent = 0;
-		statUdpReceived = 0;
-		statUdpReceivedExtra = 0;
 	}
 	#endif
 
@@ -464,5 +959,6 @@ bool Server::step(long long stepUs) {
 }
 
 void Server::end() {
+	stopWorkers();
 	log.info(name, "stop");
 }
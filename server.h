@@ -18,12 +18,19 @@
 #ifndef _SERVER_H_
 #define _SERVER_H_
 
+#include <map>
 #include <set>
 #include <vector>
 #include <string>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <random>
 
 #include "log.h"
+#include "hashmap.h"
 #include "event.h"
+#include "pacer.h"
 #include "socket.h"
 #include "connection.h"
 
@@ -43,6 +50,11 @@ private:
 	Event eventRead;
 	Event eventClose;
 
+	// udp-sockets shared by connections of this listener, when server.tcpListenerUdpSockets is set
+	std::vector<UdpListener*> udpListeners;
+
+	UdpListener* chooseUdpListener();
+
 public:
 	TcpListener(
 		Server &server,
@@ -56,6 +68,9 @@ public:
 	const std::string getName() const { return name; }
 	const Address& getTcpAddress() const { return socket.getAddressLocal(); }
 	const Address& getUdpAddress() const { return udpAddress; }
+
+	const std::vector<UdpListener*>& getUdpListeners() const { return udpListeners; }
+	void detachUdpListener(UdpListener &udpListener);
 };
 
 class UdpListener: public Event::Handler {
@@ -65,15 +80,53 @@ private:
 	Socket socket;
 	Address tcpAddress;
 	Event eventRead;
+	Event eventWrite;
 	Event eventClose;
 
+	// connections awaiting writability of socket,
+	// only eventWrite is subscribed to socket, so readiness change is O(1)
+	std::vector<Connection*> writeQueue;
+	std::vector<Connection*> writeQueueProcessing;
+
+	// datagrams of all connections collected during loop iteration,
+	// sent by single system call in flush
+	struct TransmitItem {
+		Connection *connection;
+		Packet packet;
+		TransmitItem(): connection() { }
+	};
+	std::vector<TransmitItem> transmitQueue;
+
 	int lastTcpSocketIndex;
-	Address receiveAddress;
-	Packet receivePacket;
+	std::mt19937 connectionIdRandom;
+	// count of sockets sharing port, when kernel steers datagrams between them by program
+	int steeringCount;
 	int receivePacketSize;
+	int receiveBatchSize;
+	std::vector<Packet> receivePackets;
+	std::vector<Address> receiveAddresses;
+	std::vector<int> receiveSizes;
+	std::vector<int> receiveSegmentSizes;
+	Packet receiveSegment;
+
+	// not initialized, so memory pages touched only by really big datagrams
+	char *receiveTails;
+	int receiveTailsSize;
+
+	UdpListener(const UdpListener&);
+	UdpListener& operator=(const UdpListener&);
+
+	void receive(Packet &packet, const Address &address);
+
+	// connections are found by id when packet tagged by it (so remote address may change),
+	// untagged packets are from connections which are alone at their pair of addresses
+	HashMap<Address, Connection*> connectionsByAddress;
+	HashMap<unsigned int, Connection*> connectionsById;
+	int connectionsCount;
 
 public:
-	std::map<Address, Connection*> connections;
+	// tcp-listener which shares this socket between its connections
+	TcpListener *owner;
 
 	UdpListener(
 		Server &server,
@@ -81,7 +134,9 @@ public:
 		const Address &udpAddress,
 		const Address &tcpAddress,
 		int receivePacketSize,
-		int receiveAddressSize );
+		int receiveAddressSize,
+		int receiveBatchSize );
+	~UdpListener();
 
 	void handle(Event &event, long long plannedTimeUs);
 
@@ -90,12 +145,59 @@ public:
 	const Address& getUdpAddress() const { return socket.getAddressLocal(); }
 
 	Connection* connectionByAddress(const Address &udpAddress);
+	Connection* connectionById(unsigned int connectionId);
+	unsigned int createConnectionId();
+	// id which steers tagged packets to same socket of shared port as untagged ones from address
+	unsigned int createConnectionId(const Address &udpAddress);
+	bool isSteeredTogether(unsigned int connectionId, const Address &udpAddress) const;
+
+	// connection tagged from start is registered by id only
+	void addConnection(Connection &connection);
+	void removeConnection(Connection &connection);
+	bool addConnectionId(Connection &connection);
+	void removeConnectionId(Connection &connection);
+	void onConnectionAddressChanged(Connection &connection, const Address &prevUdpAddress);
+	int getConnectionsCount() const { return connectionsCount; }
+	void waitWrite(Connection &connection);
+	void cancelWaitWrite(Connection &connection);
+
+	void transmit(Connection &connection, const Packet &packet);
+	void transmit(Connection &connection, Packet &&packet);
+	void cancelTransmit(Connection &connection);
+	void flush();
+
 	Socket& getSocket() { return socket; }
 	const Socket& getSocket() const { return socket; }
 };
 
 class Server {
 public:
+	// counters of statistics interval, workers add them to main server
+	struct Statistics {
+		long long tcpSent;
+		long long tcpReceived;
+		long long udpSent;
+		long long udpReceived;
+		long long udpReceivedExtra;
+		long long cpuWorkUs;
+		long long cpuSleepUs;
+		long long pollCalls;
+		long long pollCount;
+		long long pollOversleepUs;
+		long long pollOversleepMaxUs;
+		int packetsLive;
+		int packetsFree;
+		int connections;
+		double speedSum;
+		double speedSqrSum;
+		double speedMin;
+		double speedMax;
+
+		Statistics() { clear(); }
+		void clear();
+		void add(const Statistics &other);
+	};
+
 	std::string name;
 	int lastObjectIndex;
 
@@ -105,8 +207,13 @@ public:
 
 	int tcpBacklog;
 	int tcpReceiveAddressSize;
+	int tcpReceiveChunkSize;
 	int udpReceivePacketSize;
 	int udpReceiveAddressSize;
+	int udpReceiveBatchSize;
+	bool udpSegmentationOffload;
+	bool udpReceiveOffload;
+	int tcpListenerUdpSockets;
 	int udpSendPacketSize;
 	int udpMaxSentBufferSize;
 	int udpMaxReceiveBufferSize;
@@ -119,11 +226,19 @@ public:
 	long long buildConfirmationsUs;
 	long long buildUdpPacketsUs;
 	long long udpMaxSentMeasureUs;
+	long long udpAddressChangeUs;
+	int packetPoolSize;
+	int eventDrainBudget;
+	long long udpPacerTickUs;
+	int udpPacerBurst;
+	int threads;
+	int processes;
 
 	std::set<TcpListener*> tcpListeners;
 	std::set<UdpListener*> udpListeners;
 	std::set<BenchmarkTcpServer*> testListeners;
 	std::set<Connection*> connections;
+	std::vector<UdpListener*> udpTransmitListeners;
 
 	long long udpSummaryConnectionsSendIntervalUs;
 
@@ -134,28 +249,66 @@ public:
 	long long statUdpReceivedExtra;
 	long long statCpuWorkUs;
 	long long statCpuSleepUs;
+	long long statPollCalls;
+	long long statPollCount;
+	long long statPollOversleepUs;
+	long long statPollOversleepMaxUs;
 	long long statLastMeasureUs;
 
 	Log log;
 	Event::Manager eventManager;
 	Socket::Group socketGroup;
+	Packet::Pool packetPool;
+
+	// paces udp-writes of all connections, connections of udp-listeners
+	// keep priority of their sockets events
+	Pacer udpPacer;
+	Pacer udpPriorityPacer;
+
+	// worker loops of multi-threaded server, each one has own event manager,
+	// socket group and connections, listeners of workers share ports (SO_REUSEPORT)
+	Server *parent;
+	int index;
+	std::vector<Server*> workers;
+	std::vector<std::thread> workerThreads;
+	std::atomic<bool> stopping;
+	std::mutex statisticsMutex;
+	Statistics workerStatistics;
 
 	Server(const std::string &name);
+	Server(Server &parent, int index);
 	~Server();
 
 	void onTcpListenerClosed(TcpListener &tcpListener, bool error = false);
 	void onUdpListenerClosed(UdpListener &udpListener, bool error = false);
 	void onConnectionClosed(Connection &connection);
 
+	// listeners of several threads or processes bound to same ports
+	bool isPortShared() const { return threads > 1 || processes > 1; }
+	int getPortSharersCount() const { return threads*processes; }
+
+	std::string createObjectIndex();
 	TcpListener* createTcpListener(const Address &tcpAddress, const Address &udpAddress);
 	UdpListener* createUdpListener(const Address &udpAddress, const Address &tcpAddress);
 	BenchmarkTcpServer* createTestListener(const Address &tcpAddress);
-	Connection* createConnection(Socket &tcpSocket, UdpListener &udpListener, const Address &udpAddress);
+	Connection* createConnection(
+		Socket &tcpSocket,
+		UdpListener &udpListener,
+		const Address &udpAddress,
+		unsigned int connectionId = 0,
+		bool connectionIdNegotiated = false );
+
+	void udpFlush();
 
 	long long getUdpInitialIntervalUs() const;
 	double getUdpInitialSpeed() const;
 
+	void collectStatistics(Statistics &statistics);
+	void logStatistics(const Statistics &statistics, double dt);
+
 	void run(long long stepUs = 2000000);
+	void runWorker();
+	void stopWorkers();
 
 	void begin();
 	bool stepWhile(long long durationUs, bool force = false);
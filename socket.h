@@ -29,8 +29,20 @@ public:
 		UDP,
 		TCP
 	};
+	enum {
+		MaxBuffers = 256,
+		MaxSegments = 64,          // limits of udp segmentation offload
+		MaxSegmentsSize = 65000,
+		MaxDatagramSize = 65536
+	};
 
 	class Group {
+	public:
+		enum Backend {
+			BackendPoll,   // readiness notifications (epoll or select)
+			BackendUring   // completions of io_uring with multishot requests (linux only)
+		};
+
 	private:
 		friend class Socket;
 		struct Internal;
@@ -41,6 +53,10 @@ public:
 		explicit Group(const std::string &name, Log &log);
 		~Group();
 		void poll(long long durationUs);
+		// choose system interface for socket events, allowed only while group has no sockets,
+		// returns false when backend is not supported
+		bool setBackend(Backend backend);
+		Backend getBackend() const;
 		Log& getLog() const { return *log; }
 	};
 
@@ -57,7 +73,6 @@ private:
 	bool connected;
 	bool error;
 
-	Address receiveAddress;
 	int receiveAddressSize;
 
 public:
@@ -77,11 +92,58 @@ public:
 	Socket* accept();
 
 	int read(void *data, int size);
+	int read(void * const *data, const int *sizes, int count);
 	int write(const void *data, int size);
-	int readfrom(void *data, Address &address, int size);
+	int write(const void * const *data, const int *sizes, int count);
+	int readfrom(void *data, Address &address, int size, void *tailData = NULL, int tailSize = 0);
+	// receive up to count datagrams at once, returns count of received datagrams,
+	// size of each datagram stored in resultSizes,
+	// when receive offload enabled segmentSizes gets size of coalesced datagrams (zero if not coalesced)
+	int readfrom(
+		void * const *data,
+		const int *sizes,
+		void * const *tailData,
+		int tailSize,
+		Address *addresses,
+		int *resultSizes,
+		int count,
+		int *segmentSizes = NULL );
 	int writeto(const void *data, const Address &address, int size, const std::string &writerName = std::string());
+	// send up to count datagrams at once, returns count of processed datagrams,
+	// processing stops when socket becomes busy, size of each sent datagram stored in resultSizes
+	int writeto(
+		const void * const *data,
+		const int *sizes,
+		const Address * const *addresses,
+		int *resultSizes,
+		int count,
+		const std::string &writerName = std::string() );
 	void close(bool error = false);
 
+	// join consecutive datagrams of same size in batch writeto (generic segmentation offload),
+	// returns false when not supported by system
+	bool setSegmentation(bool enable);
+	bool getSegmentation() const;
+
+	// let kernel coalesce received datagrams of same flow (generic receive offload),
+	// returns false when not supported by system
+	bool setReceiveOffload(bool enable);
+	bool getReceiveOffload() const;
+
+	// let several sockets bind same address, kernel distributes incoming
+	// connections and datagrams between them by hash of flow, call before bind,
+	// returns false when not supported by system
+	bool setReusePort(bool enable);
+	// choose socket for datagram to shared port by hash of source address,
+	// or by connection id of tagged packet (so flow survives change of address),
+	// every flow is received by same socket while count of sockets is stable,
+	// count is total count of sockets bound to port, call after bind
+	bool setReusePortSteering(int count);
+	// index of socket which steering program chooses for untagged datagram from address
+	// and for datagram tagged by connection id, as computed by kernel
+	static int getSteeringIndex(const Address &address, int count);
+	static int getSteeringIndex(unsigned int connectionId, int count);
+
 	void closeRead(bool error = false) {
 		if (error) this->error = true;
 		if (!sourceCloseRead.getReady()) {
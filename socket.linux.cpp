@@ -20,27 +20,315 @@
 #include <cerrno>
 
 #include <algorithm>
+#include <deque>
 #include <vector>
 
 #include <unistd.h>
+#include <linux/filter.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include "socket.h"
+#include "uring.h"
+
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+
+struct Socket::Internal {
+	struct Received {
+		int buffer;
+		int size;
+		Received(int buffer = 0, int size = 0): buffer(buffer), size(size) { }
+	};
+
+	int fd;
+	bool segmentation;
+	bool receiveOffload;
+
+	// io_uring backend
+	int slot;
+	int pollKind;
+	bool pollArmed;
+	bool receiveArmed;
+	bool receiveMultishot;
+	std::deque<Received> received;
+	msghdr receiveHeader;
+
+	Internal():
+		fd(),
+		segmentation(),
+		receiveOffload(),
+		slot(-1),
+		pollKind(),
+		pollArmed(),
+		receiveArmed(),
+		receiveMultishot()
+	{ memset(&receiveHeader, 0, sizeof(receiveHeader)); }
+};
 
 
 struct Socket::Group::Internal {
+	enum {
+		UringEntries = 4096,
+		UringBufferGroup = 1,
+		UringBufferSize = 4096,
+		UringBufferCount = 1024,
+		UringMaxAddressSize = 128,
+
+		// kinds of multishot requests, stored in lower bits of user data
+		KindPoll = 1,       // poll without EPOLLIN, data comes by multishot receive
+		KindPollRead = 2,
+		KindReceive = 3,
+		KindBits = 2
+	};
+
+	Group *owner;
 	int fd;
+	int timerFd;
 	std::vector<epoll_event> events;
 	int count;
-	Internal(): fd(), count() { }
+
+	Backend backend;
+	Uring uring;
+	std::vector<Socket*> slots;
+	std::vector<int> slotRequests;
+	std::vector<int> freeSlots;
+	std::vector<int> arming;    // slots of sockets waiting for (re)arm of requests
+	std::vector<int> starving;  // slots of sockets waiting for free buffers to receive
+
+	explicit Internal(Group &owner): owner(&owner), fd(), timerFd(-1), count(), backend(BackendPoll) { }
+
+	static unsigned long long userData(int slot, int kind)
+		{ return ((unsigned long long)slot << KindBits) | kind; }
+
+	bool attach(Socket &socket);
+	bool detach(Socket &socket);
+	void submit(int opcode, unsigned long long target);
+	void arm(Socket &socket);
+	void stopReceive(Socket &socket);
+	void process(const Uring::Completion &completion);
+	void pollUring(long long durationUs);
 };
 
+bool Socket::Group::Internal::attach(Socket &socket) {
+	if (backend == BackendPoll) {
+		epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+		event.data.ptr = &socket;
+		return ::epoll_ctl(fd, EPOLL_CTL_ADD, socket.internal->fd, &event) == 0;
+	}
+
+	int slot;
+	if (freeSlots.empty()) {
+		slot = (int)slots.size();
+		slots.push_back(NULL);
+		slotRequests.push_back(0);
+	} else {
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+	}
+	slots[slot] = &socket;
+	socket.internal->slot = slot;
+	// requests will be armed at next poll, when options of socket are already set
+	arming.push_back(slot);
+	return true;
+}
+
+bool Socket::Group::Internal::detach(Socket &socket) {
+	if (backend == BackendPoll)
+		return ::epoll_ctl(fd, EPOLL_CTL_DEL, socket.internal->fd, (epoll_event*)1) == 0; // pass any ptr to prevent bug at old kernels
+
+	Socket::Internal &si = *socket.internal;
+	int slot = si.slot;
+	if (slot < 0) return true;
+	if (si.pollArmed) submit(IORING_OP_POLL_REMOVE, userData(slot, si.pollKind));
+	if (si.receiveArmed) submit(IORING_OP_ASYNC_CANCEL, userData(slot, KindReceive));
+	for(std::deque<Socket::Internal::Received>::iterator i = si.received.begin(); i != si.received.end(); ++i)
+		uring.recycleBuffer(i->buffer);
+	si.received.clear();
+	si.pollArmed = si.receiveArmed = si.receiveMultishot = false;
+	si.slot = -1;
+
+	// slot stays busy until final completions of its requests
+	slots[slot] = NULL;
+	if (!slotRequests[slot]) freeSlots.push_back(slot);
+	return true;
+}
+
+void Socket::Group::Internal::submit(int opcode, unsigned long long target) {
+	if (io_uring_sqe *sqe = uring.prepare()) {
+		sqe->opcode = opcode;
+		sqe->fd = -1;
+		sqe->addr = target;
+		sqe->user_data = 0; // completions of cancel requests are ignored
+	} else {
+		owner->log->error(owner->name, "io_uring submission queue is full");
+	}
+}
+
+void Socket::Group::Internal::arm(Socket &socket) {
+	Socket::Internal &si = *socket.internal;
+	int slot = si.slot;
+	if (slot < 0 || si.fd < 0) return;
+
+	if (!si.pollKind) {
+		si.receiveMultishot = socket.type == UDP && !si.receiveOffload;
+		si.pollKind = si.receiveMultishot ? KindPoll : KindPollRead;
+		si.receiveHeader.msg_namelen = std::min((int)UringMaxAddressSize, socket.receiveAddressSize);
+	}
+
+	if (!si.pollArmed) {
+		io_uring_sqe *sqe = uring.prepare();
+		if (!sqe) { arming.push_back(slot); return; }
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = si.fd;
+		sqe->len = IORING_POLL_ADD_MULTI;
+		sqe->poll32_events = EPOLLOUT | EPOLLRDHUP | (si.pollKind == KindPollRead ? EPOLLIN : 0);
+		sqe->user_data = userData(slot, si.pollKind);
+		si.pollArmed = true;
+		++slotRequests[slot];
+	}
+
+	if (si.receiveMultishot && !si.receiveArmed) {
+		if (uring.getBuffersFree() <= 0) { starving.push_back(slot); return; }
+		io_uring_sqe *sqe = uring.prepare();
+		if (!sqe) { arming.push_back(slot); return; }
+		sqe->opcode = IORING_OP_RECVMSG;
+		sqe->fd = si.fd;
+		sqe->addr = (unsigned long long)&si.receiveHeader;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = uring.getBufferGroup();
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->user_data = userData(slot, KindReceive);
+		si.receiveArmed = true;
+		++slotRequests[slot];
+	}
+}
+
+void Socket::Group::Internal::stopReceive(Socket &socket) {
+	// fall back to poll with EPOLLIN and usual recvmmsg
+	Socket::Internal &si = *socket.internal;
+	if (si.slot < 0 || !si.receiveMultishot) return;
+	if (si.receiveArmed) submit(IORING_OP_ASYNC_CANCEL, userData(si.slot, KindReceive));
+	if (si.pollArmed) submit(IORING_OP_POLL_REMOVE, userData(si.slot, si.pollKind));
+	si.receiveMultishot = false;
+	si.pollKind = KindPollRead;
+	si.pollArmed = false;
+	arming.push_back(si.slot);
+	if (!socket.sourceCloseRead.getReady())
+		socket.sourceRead.setReady(true);
+}
+
+void Socket::Group::Internal::process(const Uring::Completion &completion) {
+	if (!completion.userData) return;
+	int slot = (int)(completion.userData >> KindBits);
+	int kind = (int)(completion.userData & ((1 << KindBits) - 1));
+	bool more = completion.flags & IORING_CQE_F_MORE;
+	bool buffer = completion.flags & IORING_CQE_F_BUFFER;
+	int bufferId = (int)(completion.flags >> IORING_CQE_BUFFER_SHIFT);
+	if (slot < 0 || slot >= (int)slots.size()) return;
+	if (!more) --slotRequests[slot];
+
+	Socket *socket = slots[slot];
+	if (!socket) {
+		if (buffer) uring.recycleBuffer(bufferId);
+		if (!more && !slotRequests[slot]) freeSlots.push_back(slot);
+		return;
+	}
+	Socket::Internal &si = *socket->internal;
+
+	if (kind == KindReceive) {
+		if (buffer) {
+			if (completion.result >= 0)
+				si.received.push_back(Socket::Internal::Received(bufferId, completion.result));
+			else
+				uring.recycleBuffer(bufferId);
+		}
+		if (!more) {
+			si.receiveArmed = false;
+			if (completion.result == -ENOBUFS) {
+				if (si.receiveMultishot) starving.push_back(slot);
+			} else
+			if (completion.result == -EINVAL) {
+				owner->log->warning(socket->name, "multishot receive is not supported by kernel, use poll");
+				stopReceive(*socket);
+			} else
+			if (completion.result != -ECANCELED) {
+				if (completion.result < 0)
+					owner->log->errorno(socket->name, "io_uring recvmsg", -completion.result);
+				if (si.receiveMultishot) arming.push_back(slot);
+			}
+		}
+		if (!si.received.empty() && !socket->sourceCloseRead.getReady())
+			socket->sourceRead.setReady(true);
+		return;
+	}
+
+	if (!more && kind == si.pollKind) {
+		si.pollArmed = false;
+		if (completion.result != -ECANCELED) arming.push_back(slot);
+	}
+	if (completion.result <= 0) return;
+
+	// completion may contain only events of single wakeup, not full state of socket,
+	// so readiness is only raised here and dropped by EAGAIN
+	unsigned int events = (unsigned int)completion.result;
+	bool readable = (events & EPOLLIN) || !si.received.empty();
+	if (socket->connected && (events & (EPOLLRDHUP | EPOLLHUP)))
+		socket->closeWrite();
+	if (events & EPOLLERR)
+		socket->closeWrite(true);
+	if (!readable && !socket->sourceRead.getReady() && socket->sourceCloseWrite.getReady())
+		socket->closeRead();
+	if (readable && !socket->sourceCloseRead.getReady())
+		socket->sourceRead.setReady(true);
+	if ((events & EPOLLOUT) && !socket->sourceCloseWrite.getReady())
+		socket->sourceWrite.setReady(true);
+}
+
+void Socket::Group::Internal::pollUring(long long durationUs) {
+	if (!starving.empty() && uring.getBuffersFree() > 0) {
+		arming.insert(arming.end(), starving.begin(), starving.end());
+		starving.clear();
+	}
+	if (!arming.empty()) {
+		std::vector<int> current;
+		current.swap(arming);
+		for(std::vector<int>::iterator i = current.begin(); i != current.end(); ++i)
+			if (slots[*i]) arm(*slots[*i]);
+	}
+
+	int error = uring.enter(durationUs);
+	if (error && error != EINTR) {
+		owner->log->errorno(owner->name, "io_uring_enter failed", error);
+		usleep(1000);
+		return;
+	}
+
+	Uring::Completion completion;
+	while(uring.pop(completion))
+		process(completion);
+}
+
+
 Socket::Group::Group(const std::string &name, Log &log):
-	internal(new Internal()),
+	internal(new Internal(*this)),
 	name(name),
 	log(&log)
 {
@@ -48,20 +336,86 @@ Socket::Group::Group(const std::string &name, Log &log):
 	internal->events.resize(1000);
 	if (internal->fd < 0)
 		this->log->error(this->name, "epoll_create failed");
+
+	// epoll_wait accepts timeout in milliseconds only,
+	// so microsecond waits made by timer registered in epoll set
+	internal->timerFd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN | EPOLLET;
+	event.data.ptr = NULL;
+	if (internal->timerFd < 0) {
+		this->log->errorno(this->name, "timerfd_create failed, use millisecond waits");
+	} else
+	if (::epoll_ctl(internal->fd, EPOLL_CTL_ADD, internal->timerFd, &event)) {
+		this->log->errorno(this->name, "cannot register timer in epoll, use millisecond waits");
+		::close(internal->timerFd);
+		internal->timerFd = -1;
+	}
 }
 
 Socket::Group::~Group() {
+	internal->uring.close();
+	if (internal->timerFd >= 0) ::close(internal->timerFd);
 	::close(internal->fd);
 	delete internal;
 }
 
+bool Socket::Group::setBackend(Backend backend) {
+	if (internal->backend == backend) return true;
+	if (internal->count) {
+		log->error(name, "cannot change backend while group has sockets");
+		return false;
+	}
+
+	if (backend == BackendUring) {
+		// waits with timeout (EXT_ARG) appeared in linux 5.11, provided buffer rings in 5.19
+		int error = internal->uring.open(Internal::UringEntries);
+		if (!error && !internal->uring.hasFeature(IORING_FEAT_EXT_ARG))
+			error = EOPNOTSUPP;
+		if (!error)
+			error = internal->uring.openBuffers(Internal::UringBufferGroup, Internal::UringBufferSize, Internal::UringBufferCount);
+		if (error) {
+			log->errorno(name, "io_uring backend is not supported, use poll", error);
+			internal->uring.close();
+			return false;
+		}
+	} else {
+		internal->uring.close();
+	}
+
+	internal->slots.clear();
+	internal->slotRequests.clear();
+	internal->freeSlots.clear();
+	internal->arming.clear();
+	internal->starving.clear();
+	internal->backend = backend;
+	return true;
+}
+
+Socket::Group::Backend Socket::Group::getBackend() const
+	{ return internal->backend; }
+
 void Socket::Group::poll(long long durationUs) {
 	if (durationUs < 0) durationUs = 0;
-	long long durationMs = (durationUs + rand()%1000)/1000;
+	if (internal->backend == BackendUring) {
+		internal->pollUring(durationUs);
+		return;
+	}
+
+	int timeoutMs = (int)std::min((durationUs + 999)/1000, 1000000ll);
+	if (durationUs > 0 && internal->timerFd >= 0) {
+		itimerspec spec;
+		memset(&spec, 0, sizeof(spec));
+		spec.it_value.tv_sec = durationUs/1000000;
+		spec.it_value.tv_nsec = durationUs%1000000*1000;
+		if (::timerfd_settime(internal->timerFd, 0, &spec, NULL) == 0)
+			timeoutMs = -1;
+	}
 
-	if ((int)internal->events.size() < 3*internal->count)
-		internal->events.resize(6*internal->count);
-    int nfds = epoll_wait(internal->fd, &internal->events.front(), internal->events.size(), durationMs);
+	if ((int)internal->events.size() < 3*internal->count + 1)
+		internal->events.resize(6*internal->count + 1);
+    int nfds = epoll_wait(internal->fd, &internal->events.front(), internal->events.size(), timeoutMs);
     if (nfds == -1) {
 		this->log->errorno(name, "epoll_wait failed");
 		usleep(1000);
@@ -69,6 +423,7 @@ void Socket::Group::poll(long long durationUs) {
     }
 
     for(int i = 0; i < nfds; ++i) {
+    	if (!internal->events[i].data.ptr) continue; // timer
     	Socket &socket = *(Socket*)internal->events[i].data.ptr;
     	if (socket.connected && (internal->events[i].events & (EPOLLRDHUP | EPOLLHUP)))
     		socket.closeWrite();
@@ -82,12 +437,6 @@ void Socket::Group::poll(long long durationUs) {
 }
 
 
-struct Socket::Internal {
-	int fd;
-	Internal(): fd() { }
-};
-
-
 Socket::Socket(Group &group, const std::string &name, Type type, int receiveAddressSize, void *internalId):
 	internal(new Internal()),
 	group(&group),
@@ -96,7 +445,7 @@ Socket::Socket(Group &group, const std::string &name, Type type, int receiveAddr
 	lastClientIndex(),
 	connected(internalId != NULL),
 	error(),
-	receiveAddressSize(receiveAddressSize)
+	receiveAddressSize(std::max(0, std::min((int)Address::MaxSize, receiveAddressSize)))
 {
 	++group.internal->count;
 
@@ -117,16 +466,12 @@ Socket::Socket(Group &group, const std::string &name, Type type, int receiveAddr
 
 	unsigned long int ulIntOn = 1;
 	int intOn = 1;
-	epoll_event event;
-	memset(&event, 0, sizeof(event));
-	event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
-	event.data.ptr = this;
 
 	if (internal->fd < 0) {
 		group.log->errorno(this->name, "cannot create socket");
 		close(true);
 	} else
-	if (::epoll_ctl(group.internal->fd, EPOLL_CTL_ADD, internal->fd, &event)) {
+	if (!group.internal->attach(*this)) {
 		group.log->errorno(name, "cannot register socket in epoll (epoll_ctl)");
 		::shutdown(internal->fd, SHUT_RDWR);
 		::close(internal->fd);
@@ -148,14 +493,14 @@ Socket::~Socket() {
 
 void Socket::bind(const Address &address) {
 	addressLocal = address;
-	if (::bind(internal->fd, (const sockaddr*)&address.data.front(), address.data.size()))
+	if (::bind(internal->fd, (const sockaddr*)address.data, address.size))
 		group->log->errorno(name, "bind");
 }
 
 void Socket::connect(const Address &address) {
 	connected = true;
 	addressRemote = address;
-	if (::connect(internal->fd, (const sockaddr*)&address.data.front(), address.data.size()))
+	if (::connect(internal->fd, (const sockaddr*)address.data, address.size))
 		if (errno != EINPROGRESS)
 			group->log->errorno(name, "connect(" + address.toString() + ")");
 }
@@ -166,16 +511,15 @@ void Socket::listen(int backlog) {
 }
 
 Socket* Socket::accept() {
-	receiveAddress.data.resize(receiveAddressSize);
-	unsigned int addressSize = receiveAddress.data.size();
-	int fd = ::accept(internal->fd, (::sockaddr*)&receiveAddress.data.front(), &addressSize);
+	Address receiveAddress;
+	unsigned int addressSize = receiveAddressSize;
+	int fd = ::accept(internal->fd, (::sockaddr*)receiveAddress.data, &addressSize);
 	if (fd < 0) {
-		receiveAddress.data.clear();
 		if (errno == EAGAIN) sourceRead.setReady(false); else
 			if (errno != EINTR) group->log->errorno(name, "accept");
 		return NULL;
 	}
-	receiveAddress.data.resize(addressSize);
+	receiveAddress.size = std::min(addressSize, (unsigned int)receiveAddressSize);
 
 	std::string clientName = Log::strprintf("%s(client%d)", name.c_str(), ++lastClientIndex);
 	Socket *client = new Socket(*group, clientName, type, receiveAddressSize, &fd);
@@ -186,7 +530,6 @@ Socket* Socket::accept() {
 
 	client->addressLocal = addressLocal;
 	client->addressRemote = receiveAddress;
-	memcpy(&client->addressRemote.data.front(), &receiveAddress.data.front(), addressSize);
 	return client;
 }
 
@@ -209,6 +552,37 @@ int Socket::read(void *data, int size) {
 	return result >= 0 ? result : 0;
 }
 
+int Socket::read(void * const *data, const int *sizes, int count) {
+	if (sourceCloseRead.getReady()) {
+		group->log->error(name, "read: socket closed for read");
+		return 0;
+	}
+	if (!sourceRead.getReady())
+		group->log->warning(name, "read: socket was not ready for read");
+
+	iovec iov[MaxBuffers];
+	count = std::min(count, (int)MaxBuffers);
+	for(int i = 0; i < count; ++i) {
+		iov[i].iov_base = data[i];
+		iov[i].iov_len = sizes[i];
+	}
+
+	msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+
+	int result = ::recvmsg(internal->fd, &msg, MSG_NOSIGNAL);
+	if (result < 0) {
+		if (errno == EAGAIN) sourceRead.setReady(false); else
+			if (errno != EINTR) group->log->errorno(name, "recvmsg");
+	} else
+	if (result == 0)
+		closeRead();
+
+	return result >= 0 ? result : 0;
+}
+
 int Socket::write(const void *data, int size) {
 	if (sourceCloseWrite.getReady()) {
 		group->log->error(name, "write: socket closed for write");
@@ -226,7 +600,36 @@ int Socket::write(const void *data, int size) {
 	return std::max(0, result);
 }
 
-int Socket::readfrom(void *data, Address &address, int size) {
+int Socket::write(const void * const *data, const int *sizes, int count) {
+	if (sourceCloseWrite.getReady()) {
+		group->log->error(name, "write: socket closed for write");
+		return 0;
+	}
+	if (!sourceWrite.getReady())
+		group->log->warning(name, "write: socket was not ready for write");
+
+	iovec iov[MaxBuffers];
+	count = std::min(count, (int)MaxBuffers);
+	for(int i = 0; i < count; ++i) {
+		iov[i].iov_base = const_cast<void*>(data[i]);
+		iov[i].iov_len = sizes[i];
+	}
+
+	msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+
+	int result = ::sendmsg(internal->fd, &msg, MSG_NOSIGNAL);
+	if (result < 0) {
+		if (errno == EAGAIN) sourceWrite.setReady(false); else
+			if (errno != EINTR) group->log->errorno(name, "sendmsg");
+	}
+
+	return std::max(0, result);
+}
+
+int Socket::readfrom(void *data, Address &address, int size, void *tailData, int tailSize) {
 	if (sourceCloseRead.getReady()) {
 		group->log->error(name, "readfrom: socket closed for read");
 		return 0;
@@ -234,21 +637,138 @@ int Socket::readfrom(void *data, Address &address, int size) {
 	if (!sourceRead.getReady())
 		group->log->warning(name, "readfrom: socket was not ready for read");
 
-	address.data.clear();
-	receiveAddress.data.resize(receiveAddressSize);
-	unsigned int addressSize = receiveAddress.data.size();
-	int result = ::recvfrom(internal->fd, data, size, MSG_NOSIGNAL | MSG_TRUNC, (::sockaddr*)&receiveAddress.data.front(), &addressSize);
+	address.clear();
+	if (!internal->received.empty() || internal->receiveMultishot) {
+		void *tails[] = { tailData };
+		int resultSize = 0;
+		return readfrom(&data, &size, tails, tailSize, &address, &resultSize, 1) ? resultSize : 0;
+	}
+	iovec iov[2];
+	iov[0].iov_base = data;
+	iov[0].iov_len = size;
+	iov[1].iov_base = tailData;
+	iov[1].iov_len = tailSize;
+
+	msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = address.data;
+	msg.msg_namelen = receiveAddressSize;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = tailData && tailSize > 0 ? 2 : 1;
+
+	int result = ::recvmsg(internal->fd, &msg, MSG_NOSIGNAL | MSG_TRUNC);
+	unsigned int addressSize = msg.msg_namelen;
 	if (result < 0) {
 		if (errno == EAGAIN) sourceRead.setReady(false); else
 			if (errno != EINTR) group->log->errorno(name, "recvfrom");
 	} else {
-		address.data.resize(addressSize);
-		memcpy(&address.data.front(), &receiveAddress.data.front(), addressSize);
+		address.size = std::min(addressSize, (unsigned int)receiveAddressSize);
 	}
 
 	return std::max(0, result);
 }
 
+int Socket::readfrom(
+	void * const *data,
+	const int *sizes,
+	void * const *tailData,
+	int tailSize,
+	Address *addresses,
+	int *resultSizes,
+	int count,
+	int *segmentSizes )
+{
+	if (sourceCloseRead.getReady()) {
+		group->log->error(name, "readfrom: socket closed for read");
+		return 0;
+	}
+	if (!sourceRead.getReady())
+		group->log->warning(name, "readfrom: socket was not ready for read");
+
+	count = std::min(count, (int)MaxBuffers);
+	if (count <= 0) return 0;
+
+	if (!internal->received.empty() || internal->receiveMultishot) {
+		// io_uring backend already received datagrams into provided buffers
+		Uring &uring = group->internal->uring;
+		int received = 0;
+		bool truncated = false;
+		while(received < count && !internal->received.empty()) {
+			Internal::Received r = internal->received.front();
+			internal->received.pop_front();
+
+			const char *buffer = uring.getBuffer(r.buffer);
+			const io_uring_recvmsg_out &out = *(const io_uring_recvmsg_out*)buffer;
+			const char *address = buffer + sizeof(out);
+			const char *payload = address + internal->receiveHeader.msg_namelen + internal->receiveHeader.msg_controllen;
+			int size = std::max(0, std::min((int)out.payloadlen, r.size - (int)(payload - buffer)));
+			int slabSize = std::min(size, sizes[received]);
+			memcpy(data[received], payload, slabSize);
+			if (tailData && tailSize > 0 && size > slabSize)
+				memcpy(tailData[received], payload + slabSize, std::min(size - slabSize, tailSize));
+
+			unsigned int addressSize = std::min(out.namelen, (unsigned int)internal->receiveHeader.msg_namelen);
+			addresses[received].set(address, addressSize);
+			resultSizes[received] = size;
+			if (segmentSizes) segmentSizes[received] = 0;
+			if (out.flags & MSG_TRUNC) truncated = true;
+
+			uring.recycleBuffer(r.buffer);
+			++received;
+		}
+
+		if (truncated && internal->receiveMultishot) {
+			group->log->warning(name, "datagram does not fit into io_uring buffer, use poll to receive");
+			group->internal->stopReceive(*this);
+		} else
+		if (internal->received.empty() && internal->receiveMultishot)
+			sourceRead.setReady(false);
+		if (received > 0 || internal->receiveMultishot)
+			return received;
+	}
+
+	// addresses received in place
+	iovec iov[MaxBuffers][2];
+	mmsghdr msgs[MaxBuffers];
+	char control[MaxBuffers][CMSG_SPACE(sizeof(int))];
+	memset(msgs, 0, count*sizeof(msgs[0]));
+	for(int i = 0; i < count; ++i) {
+		if (internal->receiveOffload) {
+			msgs[i].msg_hdr.msg_control = control[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+		}
+		iov[i][0].iov_base = data[i];
+		iov[i][0].iov_len = sizes[i];
+		iov[i][1].iov_base = tailData ? tailData[i] : NULL;
+		iov[i][1].iov_len = tailSize;
+		msgs[i].msg_hdr.msg_name = addresses[i].data;
+		msgs[i].msg_hdr.msg_namelen = receiveAddressSize;
+		msgs[i].msg_hdr.msg_iov = iov[i];
+		msgs[i].msg_hdr.msg_iovlen = tailData && tailSize > 0 ? 2 : 1;
+	}
+
+	int result = ::recvmmsg(internal->fd, msgs, count, MSG_NOSIGNAL | MSG_TRUNC, NULL);
+	if (result < 0) {
+		if (errno == EAGAIN) sourceRead.setReady(false); else
+			if (errno != EINTR) group->log->errorno(name, "recvmmsg");
+		return 0;
+	}
+
+	for(int i = 0; i < result; ++i) {
+		addresses[i].size = std::min((int)msgs[i].msg_hdr.msg_namelen, receiveAddressSize);
+		resultSizes[i] = (int)msgs[i].msg_len;
+
+		if (segmentSizes) {
+			segmentSizes[i] = 0;
+			if (internal->receiveOffload)
+				for(cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg))
+					if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+						memcpy(&segmentSizes[i], CMSG_DATA(cmsg), sizeof(int));
+		}
+	}
+	return result;
+}
+
 int Socket::writeto(const void *data, const Address &address, int size, const std::string &writerName) {
 	if (sourceCloseWrite.getReady()) {
 		group->log->error(name + "(" + writerName + ")", "writeto: socket closed for write");
@@ -257,7 +777,7 @@ int Socket::writeto(const void *data, const Address &address, int size, const st
 	if (!sourceWrite.getReady())
 		group->log->warning(name + "(" + writerName + ")", "writeto: socket was not ready for write");
 
-	int result = ::sendto(internal->fd, data, size, MSG_NOSIGNAL, (const ::sockaddr*)&address.data.front(), address.data.size());
+	int result = ::sendto(internal->fd, data, size, MSG_NOSIGNAL, (const ::sockaddr*)address.data, address.size);
 	if (result < 0) {
 		if (errno == EAGAIN) sourceWrite.setReady(false);  else
 			if (errno != EINTR) group->log->errorno(name + "(" + writerName + ")", "sendto");
@@ -266,10 +786,242 @@ int Socket::writeto(const void *data, const Address &address, int size, const st
 	return std::max(0, result);
 }
 
+int Socket::writeto(
+	const void * const *data,
+	const int *sizes,
+	const Address * const *addresses,
+	int *resultSizes,
+	int count,
+	const std::string &writerName )
+{
+	if (sourceCloseWrite.getReady()) {
+		group->log->error(name + "(" + writerName + ")", "writeto: socket closed for write");
+		return 0;
+	}
+	if (!sourceWrite.getReady())
+		group->log->warning(name + "(" + writerName + ")", "writeto: socket was not ready for write");
+
+	count = std::min(count, (int)MaxBuffers);
+	if (count <= 0) return 0;
+
+	// with segmentation offload consecutive datagrams of same size to same address
+	// joins into single message, kernel splits it back by UDP_SEGMENT size
+	iovec iov[MaxBuffers];
+	mmsghdr msgs[MaxBuffers];
+	char control[MaxBuffers][CMSG_SPACE(sizeof(unsigned short))];
+	int firsts[MaxBuffers];
+	int msgsCount = 0;
+	memset(msgs, 0, count*sizeof(msgs[0]));
+	for(int i = 0; i < count; ++i) {
+		iov[i].iov_base = const_cast<void*>(data[i]);
+		iov[i].iov_len = sizes[i];
+	}
+	for(int i = 0; i < count; ) {
+		int segments = 1;
+		if (internal->segmentation) {
+			int total = sizes[i];
+			while( i + segments < count
+			    && segments < MaxSegments
+			    && sizes[i + segments - 1] == sizes[i]
+			    && sizes[i + segments] <= sizes[i]
+			    && total + sizes[i + segments] <= MaxSegmentsSize
+			    && ( addresses[i + segments] == addresses[i]
+			      || *addresses[i + segments] == *addresses[i] ))
+				total += sizes[i + segments++];
+		}
+
+		msghdr &msg = msgs[msgsCount].msg_hdr;
+		msg.msg_name = const_cast<char*>(addresses[i]->data);
+		msg.msg_namelen = addresses[i]->size;
+		msg.msg_iov = &iov[i];
+		msg.msg_iovlen = segments;
+		if (segments > 1) {
+			msg.msg_control = control[msgsCount];
+			msg.msg_controllen = sizeof(control[msgsCount]);
+			cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned short));
+			unsigned short segmentSize = sizes[i];
+			memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof(segmentSize));
+		}
+		firsts[msgsCount++] = i;
+		i += segments;
+	}
+
+	int done = 0;
+	int msgsDone = 0;
+	while(msgsDone < msgsCount) {
+		int result = ::sendmmsg(internal->fd, msgs + msgsDone, msgsCount - msgsDone, MSG_NOSIGNAL);
+		if (result < 0) {
+			if (errno == EAGAIN) { sourceWrite.setReady(false); break; }
+			if (errno == EINTR) continue;
+			if (msgs[msgsDone].msg_hdr.msg_iovlen > 1) {
+				// kernel rejects segmentation, send rest of datagrams separately
+				group->log->warning(name, "udp segmentation offload rejected, disabled");
+				internal->segmentation = false;
+				return done + writeto(data + done, sizes + done, addresses + done, resultSizes + done, count - done, writerName);
+			}
+			// skip datagram which cannot be sent
+			group->log->errorno(name + "(" + writerName + ")", "sendmmsg");
+			resultSizes[done++] = 0;
+			++msgsDone;
+			continue;
+		}
+		for(int i = 0; i < result; ++i, ++msgsDone) {
+			int remain = (int)msgs[msgsDone].msg_len;
+			int end = msgsDone + 1 < msgsCount ? firsts[msgsDone + 1] : count;
+			for(; done < end; ++done) {
+				resultSizes[done] = std::min(remain, sizes[done]);
+				remain -= resultSizes[done];
+			}
+		}
+	}
+	return done;
+}
+
+bool Socket::setSegmentation(bool enable) {
+	if (enable) {
+		// probe kernel support
+		int value = 0;
+		socklen_t size = sizeof(value);
+		if (internal->fd < 0 || ::getsockopt(internal->fd, SOL_UDP, UDP_SEGMENT, &value, &size)) {
+			group->log->warning(name, "udp segmentation offload is not supported");
+			enable = false;
+		}
+	}
+	internal->segmentation = enable;
+	return enable;
+}
+
+bool Socket::getSegmentation() const
+	{ return internal->segmentation; }
+
+bool Socket::setReceiveOffload(bool enable) {
+	int value = enable ? 1 : 0;
+	if (internal->fd < 0 || ::setsockopt(internal->fd, SOL_UDP, UDP_GRO, &value, sizeof(value))) {
+		if (enable) group->log->warning(name, "udp receive offload is not supported");
+		enable = false;
+	}
+	internal->receiveOffload = enable;
+	return enable;
+}
+
+bool Socket::getReceiveOffload() const
+	{ return internal->receiveOffload; }
+
+bool Socket::setReusePort(bool enable) {
+	int value = enable ? 1 : 0;
+	if (internal->fd < 0 || ::setsockopt(internal->fd, SOL_SOCKET, SO_REUSEPORT, &value, sizeof(value))) {
+		if (enable) group->log->errorno(name, "cannot share port (SO_REUSEPORT)");
+		return false;
+	}
+	return enable;
+}
+
+static sock_filter bpfStatement(unsigned short code, unsigned int k) {
+	sock_filter statement = BPF_STMT(code, k);
+	return statement;
+}
+
+static sock_filter bpfJump(unsigned short code, unsigned int k, unsigned char jt, unsigned char jf) {
+	sock_filter statement = BPF_JUMP(code, k, jt, jf);
+	return statement;
+}
+
+bool Socket::setReusePortSteering(int count) {
+	if (count <= 1) return true;
+
+	int domain = 0;
+	socklen_t domainSize = sizeof(domain);
+	if (internal->fd < 0 || ::getsockopt(internal->fd, SOL_SOCKET, SO_DOMAIN, &domain, &domainSize)) {
+		group->log->errorno(name, "cannot get address family of socket (SO_DOMAIN)");
+		return false;
+	}
+
+	// tagged packet: index = connection id % count, id is last word of datagram,
+	// else index = hash(source address ^ source port) % count,
+	// kernel falls back to own hash while index is not less than count of bound sockets,
+	// keep in sync with getSteeringIndex
+	std::vector<sock_filter> code;
+	code.push_back(bpfStatement(BPF_LD  | BPF_B | BPF_ABS,   4));                // type of packet
+	code.push_back(bpfJump     (BPF_JMP | BPF_JSET | BPF_K,  0x80, 0, 6));       // Packet::ConnectionIdFlag
+	code.push_back(bpfStatement(BPF_LD  | BPF_W | BPF_LEN,   0));
+	code.push_back(bpfStatement(BPF_ALU | BPF_SUB | BPF_K,   4));
+	code.push_back(bpfStatement(BPF_MISC | BPF_TAX,          0));
+	code.push_back(bpfStatement(BPF_LD  | BPF_W | BPF_IND,   0));                // connection id
+	code.push_back(bpfStatement(BPF_ALU | BPF_MOD | BPF_K,   (unsigned int)count));
+	code.push_back(bpfStatement(BPF_RET | BPF_A,             0));
+	if (domain == AF_INET) {
+		code.push_back(bpfStatement(BPF_LD  | BPF_W | BPF_ABS, (unsigned int)SKF_NET_OFF + 12)); // source address
+		code.push_back(bpfStatement(BPF_ST,                    0));
+		code.push_back(bpfStatement(BPF_LDX | BPF_B | BPF_MSH, (unsigned int)SKF_NET_OFF));      // length of ip header
+		code.push_back(bpfStatement(BPF_LD  | BPF_H | BPF_IND, (unsigned int)SKF_NET_OFF));      // source port
+	} else
+	if (domain == AF_INET6) {
+		// header has fixed size of 40 bytes, source address at offset 8
+		code.push_back(bpfStatement(BPF_LD  | BPF_W | BPF_ABS, (unsigned int)SKF_NET_OFF + 8));
+		for(int i = 12; i < 24; i += 4) {
+			code.push_back(bpfStatement(BPF_MISC | BPF_TAX,        0));
+			code.push_back(bpfStatement(BPF_LD  | BPF_W | BPF_ABS, (unsigned int)SKF_NET_OFF + i));
+			code.push_back(bpfStatement(BPF_ALU | BPF_XOR | BPF_X, 0));
+		}
+		code.push_back(bpfStatement(BPF_ST,                    0));
+		code.push_back(bpfStatement(BPF_LD  | BPF_H | BPF_ABS, (unsigned int)SKF_NET_OFF + 40)); // source port
+	} else {
+		group->log->warning(name, "steering of shared port is not supported for address family %d", domain);
+		return false;
+	}
+	code.push_back(bpfStatement(BPF_LDX | BPF_MEM,           0));
+	code.push_back(bpfStatement(BPF_ALU | BPF_XOR | BPF_X,   0));
+	code.push_back(bpfStatement(BPF_ALU | BPF_MUL | BPF_K,   0x9E3779B1u));
+	code.push_back(bpfStatement(BPF_ALU | BPF_RSH | BPF_K,   16));
+	code.push_back(bpfStatement(BPF_ALU | BPF_MOD | BPF_K,   (unsigned int)count));
+	code.push_back(bpfStatement(BPF_RET | BPF_A,             0));
+
+	sock_fprog program;
+	program.len = (unsigned short)code.size();
+	program.filter = &code.front();
+	if (::setsockopt(internal->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program))) {
+		group->log->errorno(name, "cannot attach steering program to shared port (SO_ATTACH_REUSEPORT_CBPF)");
+		return false;
+	}
+	return true;
+}
+
+int Socket::getSteeringIndex(const Address &address, int count) {
+	if (count <= 1 || address.size < (int)sizeof(sockaddr)) return 0;
+	sockaddr addr;
+	memcpy(&addr, address.data, sizeof(addr));
+	unsigned int hash = 0;
+	if (addr.sa_family == AF_INET && address.size >= (int)sizeof(sockaddr_in)) {
+		sockaddr_in addr4;
+		memcpy(&addr4, address.data, sizeof(addr4));
+		hash = ntohl(addr4.sin_addr.s_addr) ^ ntohs(addr4.sin_port);
+	} else
+	if (addr.sa_family == AF_INET6 && address.size >= (int)sizeof(sockaddr_in6)) {
+		sockaddr_in6 addr6;
+		memcpy(&addr6, address.data, sizeof(addr6));
+		for(int i = 0; i < 16; i += 4) {
+			unsigned int word;
+			memcpy(&word, addr6.sin6_addr.s6_addr + i, sizeof(word));
+			hash ^= ntohl(word);
+		}
+		hash ^= ntohs(addr6.sin6_port);
+	}
+	return (int)((hash*0x9E3779B1u >> 16) % (unsigned int)count);
+}
+
+int Socket::getSteeringIndex(unsigned int connectionId, int count) {
+	// program reads id in network byte order
+	if (count <= 1) return 0;
+	return (int)(ntohl(connectionId) % (unsigned int)count);
+}
+
 void Socket::close(bool error) {
 	if (error) this->error = true;
 	if (internal->fd >= 0) {
-		if (::epoll_ctl(group->internal->fd, EPOLL_CTL_DEL, internal->fd, (epoll_event*)1)) // pass any ptr to prevent bug at old kernels
+		if (!group->internal->detach(*this))
 			group->log->errorno(name, "cannot unregister socket from epoll (epoll_ctl)");
 		::shutdown(internal->fd, SHUT_RDWR);
 		::close(internal->fd);
@@ -17,6 +17,8 @@
 
 #include <cstring>
 
+#include <algorithm>
+
 #include <winsock2.h>
 #include <windows.h>
 
@@ -67,7 +69,8 @@ Socket::Group::~Group() {
 
 void Socket::Group::poll(long long durationUs) {
 	if (durationUs < 0) durationUs = 0;
-	long long durationMs = (durationUs + rand()%1000)/1000;
+	// WSAPoll waits milliseconds only, round up to not wake before deadline
+	int durationMs = (int)std::min((durationUs + 999)/1000, 1000000ll);
 
 	if (WSAPoll(&internal->events.front(), internal->events.size(), 0) < 0) {
 		log->errorno(name, "WSAPoll failed");
@@ -112,6 +115,17 @@ void Socket::Group::poll(long long durationUs) {
     }
 }
 
+bool Socket::Group::setBackend(Backend backend) {
+	if (backend != BackendPoll) {
+		log->warning(name, "io_uring backend is not supported, use poll");
+		return false;
+	}
+	return true;
+}
+
+Socket::Group::Backend Socket::Group::getBackend() const
+	{ return BackendPoll; }
+
 
 Socket::Socket(Group &group, const std::string &name, Type type, int receiveAddressSize, void *internalId):
 	internal(new Internal()),
@@ -121,7 +135,7 @@ Socket::Socket(Group &group, const std::string &name, Type type, int receiveAddr
 	lastClientIndex(),
 	connected(internalId != NULL),
 	error(),
-	receiveAddressSize(receiveAddressSize)
+	receiveAddressSize(std::max(0, std::min((int)Address::MaxSize, receiveAddressSize)))
 {
 	if (internalId) {
 		internal->fd = *(int*)internalId;
@@ -159,14 +173,14 @@ Socket::~Socket() {
 
 void Socket::bind(const Address &address) {
 	addressLocal = address;
-	if (::bind(internal->fd, (const sockaddr*)&address.data.front(), address.data.size()))
+	if (::bind(internal->fd, (const sockaddr*)address.data, address.size))
 		group->log->errorno(name, "bind");
 }
 
 void Socket::connect(const Address &address) {
 	connected = true;
 	addressRemote = address;
-	if (::connect(internal->fd, (const sockaddr*)&address.data.front(), address.data.size()))
+	if (::connect(internal->fd, (const sockaddr*)address.data, address.size))
 		if (WSAGetLastError() != WSAEWOULDBLOCK)
 			group->log->errorno(name, "connect(" + address.toString() + ")");
 }
@@ -177,17 +191,16 @@ void Socket::listen(int backlog) {
 }
 
 Socket* Socket::accept() {
-	receiveAddress.data.resize(receiveAddressSize);
-	int addressSize = receiveAddress.data.size();
-	int fd = ::accept(internal->fd, (::sockaddr*)&receiveAddress.data.front(), &addressSize);
+	Address receiveAddress;
+	int addressSize = receiveAddressSize;
+	int fd = ::accept(internal->fd, (::sockaddr*)receiveAddress.data, &addressSize);
 	if (fd < 0) {
 		WSAGetLastError();
-		receiveAddress.data.clear();
 		if (WSAGetLastError() == WSAEWOULDBLOCK) sourceRead.setReady(false); else
 			if (WSAGetLastError() != WSAEINTR) group->log->errorno(name, "accept");
 		return NULL;
 	}
-	receiveAddress.data.resize(addressSize);
+	receiveAddress.size = std::min(addressSize, receiveAddressSize);
 
 	std::string clientName = Log::strprintf("%s(client%d)", name.c_str(), ++lastClientIndex);
 	Socket *client = new Socket(*group, clientName, type, receiveAddressSize, &fd);
@@ -198,7 +211,6 @@ Socket* Socket::accept() {
 
 	client->addressLocal = addressLocal;
 	client->addressRemote = receiveAddress;
-	memcpy(&client->addressRemote.data.front(), &receiveAddress.data.front(), addressSize);
 	return client;
 }
 
@@ -221,6 +233,35 @@ int Socket::read(void *data, int size) {
 	return result >= 0 ? result : 0;
 }
 
+int Socket::read(void * const *data, const int *sizes, int count) {
+	if (sourceCloseRead.getReady()) {
+		group->log->error(name, "read: socket closed for read");
+		return 0;
+	}
+	if (!sourceRead.getReady())
+		group->log->warning(name, "read: socket was not ready for read");
+
+	WSABUF buffers[MaxBuffers];
+	count = std::min(count, (int)MaxBuffers);
+	for(int i = 0; i < count; ++i) {
+		buffers[i].buf = (char*)data[i];
+		buffers[i].len = sizes[i];
+	}
+
+	DWORD received = 0;
+	DWORD flags = 0;
+	int result = ::WSARecv(internal->fd, buffers, count, &received, &flags, NULL, NULL);
+	if (result == 0) result = (int)received; else result = -1;
+	if (result < 0) {
+		if (WSAGetLastError() == WSAEWOULDBLOCK) sourceRead.setReady(false); else
+			if (WSAGetLastError() != WSAEINTR) group->log->errorno(name, "recv");
+	} else
+	if (result == 0)
+		closeRead();
+
+	return result >= 0 ? result : 0;
+}
+
 int Socket::write(const void *data, int size) {
 	if (sourceCloseWrite.getReady()) {
 		group->log->error(name, "write: socket closed for write");
@@ -238,7 +279,33 @@ int Socket::write(const void *data, int size) {
 	return std::max(0, result);
 }
 
-int Socket::readfrom(void *data, Address &address, int size) {
+int Socket::write(const void * const *data, const int *sizes, int count) {
+	if (sourceCloseWrite.getReady()) {
+		group->log->error(name, "write: socket closed for write");
+		return 0;
+	}
+	if (!sourceWrite.getReady())
+		group->log->warning(name, "write: socket was not ready for write");
+
+	WSABUF buffers[MaxBuffers];
+	count = std::min(count, (int)MaxBuffers);
+	for(int i = 0; i < count; ++i) {
+		buffers[i].buf = (char*)data[i];
+		buffers[i].len = sizes[i];
+	}
+
+	DWORD sent = 0;
+	int result = ::WSASend(internal->fd, buffers, count, &sent, 0, NULL, NULL);
+	if (result == 0) result = (int)sent; else result = -1;
+	if (result < 0) {
+		if (WSAGetLastError() == WSAEWOULDBLOCK) sourceWrite.setReady(false); else
+			if (WSAGetLastError() != WSAEINTR) group->log->errorno(name, "send");
+	}
+
+	return std::max(0, result);
+}
+
+int Socket::readfrom(void *data, Address &address, int size, void *tailData, int tailSize) {
 	if (sourceCloseRead.getReady()) {
 		group->log->error(name, "readfrom: socket closed for read");
 		return 0;
@@ -246,21 +313,54 @@ int Socket::readfrom(void *data, Address &address, int size) {
 	if (!sourceRead.getReady())
 		group->log->warning(name, "readfrom: socket was not ready for read");
 
-	address.data.clear();
-	receiveAddress.data.resize(receiveAddressSize);
-	int addressSize = receiveAddress.data.size();
-	int result = ::recvfrom(internal->fd, (char*)data, size, 0, (::sockaddr*)&receiveAddress.data.front(), &addressSize);
+	address.clear();
+	int addressSize = receiveAddressSize;
+
+	WSABUF buffers[2];
+	buffers[0].buf = (char*)data;
+	buffers[0].len = size;
+	buffers[1].buf = (char*)tailData;
+	buffers[1].len = tailSize;
+
+	DWORD received = 0;
+	DWORD flags = 0;
+	int result = ::WSARecvFrom(internal->fd, buffers, tailData && tailSize > 0 ? 2 : 1, &received, &flags, (::sockaddr*)address.data, &addressSize, NULL, NULL);
+	if (result == 0) result = (int)received; else result = -1;
 	if (result < 0) {
 		if (WSAGetLastError() == WSAEWOULDBLOCK) sourceRead.setReady(false); else
 			if (WSAGetLastError() != WSAEINTR) group->log->errorno(name, "recvfrom");
 	} else {
-		address.data.resize(addressSize);
-		memcpy(&address.data.front(), &receiveAddress.data.front(), addressSize);
+		address.size = std::min(addressSize, receiveAddressSize);
 	}
 
 	return std::max(0, result);
 }
 
+int Socket::readfrom(
+	void * const *data,
+	const int *sizes,
+	void * const *tailData,
+	int tailSize,
+	Address *addresses,
+	int *resultSizes,
+	int count,
+	int *segmentSizes )
+{
+	// no batch receive in winsock, read datagrams one by one
+	int received = 0;
+	for(; received < count; ++received) {
+		resultSizes[received] = readfrom(
+			data[received],
+			addresses[received],
+			sizes[received],
+			tailData ? tailData[received] : NULL,
+			tailSize );
+		if (segmentSizes) segmentSizes[received] = 0;
+		if (addresses[received].empty()) break;
+	}
+	return received;
+}
+
 int Socket::writeto(const void *data, const Address &address, int size, const std::string &writerName) {
 	if (sourceCloseWrite.getReady()) {
 		group->log->error(name + "(" + writerName + ")(" + address.toString() + ")", "writeto: socket closed for write");
@@ -269,7 +369,7 @@ int Socket::writeto(const void *data, const Address &address, int size, const st
 	if (!sourceWrite.getReady())
 		group->log->warning(name + "(" + writerName + ")(" + address.toString() + ")", "writeto: socket was not ready for write");
 
-	int result = ::sendto(internal->fd, (const char*)data, size, 0, (const ::sockaddr*)&address.data.front(), address.data.size());
+	int result = ::sendto(internal->fd, (const char*)data, size, 0, (const ::sockaddr*)address.data, address.size);
 	if (result < 0) {
 		if (WSAGetLastError() == WSAEWOULDBLOCK) sourceWrite.setReady(false);  else
 			if (WSAGetLastError() != WSAEINTR) group->log->errorno(name + "(" + writerName + ")(" + address.toString() + ")", "sendto");
@@ -278,6 +378,56 @@ int Socket::writeto(const void *data, const Address &address, int size, const st
 	return std::max(0, result);
 }
 
+int Socket::writeto(
+	const void * const *data,
+	const int *sizes,
+	const Address * const *addresses,
+	int *resultSizes,
+	int count,
+	const std::string &writerName )
+{
+	// no batch send in winsock, send datagrams one by one
+	int done = 0;
+	for(; done < count; ++done) {
+		resultSizes[done] = writeto(data[done], *addresses[done], sizes[done], writerName);
+		if (resultSizes[done] <= 0 && !sourceWrite.getReady()) break;
+	}
+	return done;
+}
+
+bool Socket::setSegmentation(bool enable) {
+	if (enable)
+		group->log->warning(name, "udp segmentation offload is not supported");
+	return false;
+}
+
+bool Socket::getSegmentation() const
+	{ return false; }
+
+bool Socket::setReceiveOffload(bool enable) {
+	if (enable)
+		group->log->warning(name, "udp receive offload is not supported");
+	return false;
+}
+
+bool Socket::getReceiveOffload() const
+	{ return false; }
+
+bool Socket::setReusePort(bool enable) {
+	if (enable)
+		group->log->warning(name, "sharing of port is not supported");
+	return false;
+}
+
+bool Socket::setReusePortSteering(int) {
+	return false;
+}
+
+int Socket::getSteeringIndex(const Address&, int)
+	{ return 0; }
+int Socket::getSteeringIndex(unsigned int, int)
+	{ return 0; }
+
 void Socket::close(bool error) {
 	if (error) this->error = true;
 	if (internal->fd != INVALID_SOCKET) {
@@ -29,25 +29,25 @@ void TestBenchmark::run() {
 	Address addressTunnel("127.0.0.1:2238");
 	Address addressServer("127.0.0.1:2239");
 
-	if (tunnel && remoteAddress.data.empty()) {
+	if (tunnel && remoteAddress.empty()) {
 		initializeUs = 150000000ll;
 		durationUs   = 300000000ll;
 	} else
-	if (tunnel && !remoteAddress.data.empty()) {
+	if (tunnel && !remoteAddress.empty()) {
 		addressTunnel = remoteAddress;
-		addressServer.data.clear();
+		addressServer.clear();
 	} else
-	if (!tunnel && remoteAddress.data.empty()) {
+	if (!tunnel && remoteAddress.empty()) {
 		initializeUs = 30000000ll;
 		durationUs   = 60000000ll;
 		size = 16.0;
 		addressClient = addressServer;
-		addressTunnel.data.clear();
+		addressTunnel.clear();
 	} else
-	if (!tunnel && !remoteAddress.data.empty()) {
+	if (!tunnel && !remoteAddress.empty()) {
 		addressClient = remoteAddress;
-		addressTunnel.data.clear();
-		addressServer.data.clear();
+		addressTunnel.clear();
+		addressServer.clear();
 	}
 
 	if (single) {
@@ -56,18 +56,18 @@ void TestBenchmark::run() {
 	}
 
 	Server server(name + "(server)");
-	if (single && remoteAddress.data.empty())
+	if (single && remoteAddress.empty())
 		server.udpMaxSentBufferSize = 64*1024*1024;
 	if (!single)
 		server.udpInitialSendIntervalUs *= 10;//*maxClients;
-	if (!addressClient.data.empty() && !addressTunnel.data.empty())
+	if (!addressClient.empty() && !addressTunnel.empty())
 		server.createTcpListener(addressClient, addressTunnel);
-	if (!addressTunnel.data.empty() && !addressServer.data.empty())
+	if (!addressTunnel.empty() && !addressServer.empty())
 		server.createUdpListener(addressTunnel, addressServer);
 	server.begin();
 
 	BenchmarkTcpServer *benchmarkTcpServer = NULL;
-	if (!addressServer.data.empty())
+	if (!addressServer.empty())
 		benchmarkTcpServer = new BenchmarkTcpServer(
 			server.socketGroup,
 			server.eventManager,
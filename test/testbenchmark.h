@@ -31,7 +31,7 @@ public:
 		Test( std::string("benchmark")
 			+ (single ? "(single)" : "")
 			+ (tunnel ? "(tunnel)" : "")
-			+ (remoteAddress.data.empty() ? "" : "(" + remoteAddress.toString() + ")"),
+			+ (remoteAddress.empty() ? "" : "(" + remoteAddress.toString() + ")"),
 			log ),
 		single(single),
 		tunnel(tunnel),
@@ -0,0 +1,85 @@
+/*
+    ......... 2016 Ivan Mahonin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "../crc32.h"
+
+#include "testcrc32.h"
+
+
+void TestCrc32::run() {
+	typedef unsigned int (*Function)(const void*, int, unsigned int);
+	const char *names[] = { "bytewise", "slicing", "clmul", "dispatched" };
+	Function functions[] = { &Crc32::calcBytewise, &Crc32::calcSlicing, &Crc32::calcClmul, &Crc32::calc };
+	int count = (int)(sizeof(functions)/sizeof(*functions));
+
+	log->info(name, "clmul %s", Crc32::isClmulSupported() ? "supported" : "not supported");
+
+	Buffer buffer;
+	buildRandomBuffer(buffer, 4*1024*1024);
+	const char *data = &buffer.front();
+
+	// known value
+	if (Crc32::calc("123456789", 9) != 0xFC891918u) {
+		log->error(name, "wrong crc of check string");
+		success = false;
+	}
+
+	// compare all implementations with bytewise for different sizes, alignments and previous values
+	for(int size = 0; size <= 600; ++size) {
+		for(int offset = 0; offset < 16; offset += 5) {
+			unsigned int previous = size*31 + offset;
+			unsigned int expected = Crc32::calcBytewise(data + offset, size, previous);
+			for(int i = 1; i < count; ++i) {
+				if (functions[i](data + offset, size, previous) != expected) {
+					log->error(name, "%s: wrong crc, size %d, offset %d", names[i], size, offset);
+					success = false;
+				}
+			}
+		}
+	}
+	unsigned int expected = Crc32::calcBytewise(data, (int)buffer.size());
+	for(int i = 1; i < count; ++i) {
+		if (functions[i](data, (int)buffer.size(), 0) != expected) {
+			log->error(name, "%s: wrong crc of whole buffer", names[i]);
+			success = false;
+		}
+	}
+
+	// measure throughput for datagram-sized and large blocks
+	int sizes[] = { 1033, 1024*1024 };
+	for(int j = 0; j < (int)(sizeof(sizes)/sizeof(*sizes)); ++j) {
+		int size = sizes[j];
+		int blocksPerCheck = std::max(1, 256*1024/size);
+		for(int i = 0; i < count; ++i) {
+			long long bytes = 0;
+			unsigned int crc = 0;
+			int offset = 0;
+			long long beginUs = Platform::nowUs();
+			long long durationUs = 0;
+			while(durationUs < 200000) {
+				for(int k = 0; k < blocksPerCheck; ++k) {
+					if (offset + size > (int)buffer.size()) offset = 0;
+					crc = functions[i](data + offset, size, crc);
+					offset += size;
+					bytes += size;
+				}
+				durationUs = Platform::nowUs() - beginUs;
+			}
+			log->info(name, "%s, block %d bytes: %f GB/s (crc %08x)",
+				names[i], size, (double)bytes/(double)durationUs/1000.0, crc );
+		}
+	}
+}
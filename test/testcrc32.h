@@ -0,0 +1,30 @@
+/*
+    ......... 2016 Ivan Mahonin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _TESTCRC32_H_
+#define _TESTCRC32_H_
+
+#include "test.h"
+
+
+class TestCrc32: public Test {
+public:
+	explicit TestCrc32(Log &log): Test("crc32", log) { }
+protected:
+	void run();
+};
+
+#endif
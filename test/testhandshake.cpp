@@ -0,0 +1,195 @@
+/*
+    ......... 2016 Ivan Mahonin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "testhandshake.h"
+
+
+void TestHandshake::send(Server &server, Socket &socket, const Address &address, const Packet &packet) {
+	long long endUs = Platform::nowUs() + 1000000;
+	while(Platform::nowUs() < endUs && !socket.sourceWrite.getReady())
+		server.step(10000);
+	socket.writeto(packet.getRawData(), address, packet.getRawSize());
+}
+
+// raw udp-socket plays remote side of tunnel and sends single hello,
+// connection created by server should agree with it,
+// zero packet size means size configured for server
+void TestHandshake::testHello(
+	const std::string &caseName,
+	const Packet &hello,
+	int packetSize,
+	unsigned int capabilities,
+	unsigned int connectionId )
+{
+	Address addressTunnel("127.0.0.1:2240");
+	Address addressServer("127.0.0.1:2241");
+	Address addressPeer("127.0.0.1:2242");
+
+	Server server(name + "(server)");
+	server.createUdpListener(addressTunnel, addressServer);
+	server.begin();
+	if (packetSize <= 0) packetSize = server.udpSendPacketSize;
+
+	{
+		SimpleTcpServer simpleTcpServer(
+			server.socketGroup,
+			server.eventManager,
+			name + "(simpleTcpServer)",
+			addressServer );
+
+		Socket peer(server.socketGroup, name + "(peer)", Socket::UDP);
+		peer.bind(addressPeer);
+		send(server, peer, addressTunnel, hello);
+
+		long long endUs = Platform::nowUs() + 1000000;
+		while(Platform::nowUs() < endUs && server.connections.empty())
+			server.step(10000);
+
+		if (server.connections.empty()) {
+			log->error(name, "%s: connection was not created", caseName.c_str());
+			success = false;
+		} else {
+			const Connection &connection = **server.connections.begin();
+			if (connection.getUdpSendPacketSize() != packetSize) {
+				log->error(name, "%s: packet size %d, expected %d", caseName.c_str(), connection.getUdpSendPacketSize(), packetSize);
+				success = false;
+			}
+			if (connection.getCapabilities() != capabilities) {
+				log->error(name, "%s: capabilities %08x, expected %08x", caseName.c_str(), connection.getCapabilities(), capabilities);
+				success = false;
+			}
+			if (connection.getSendConnectionId() != connectionId) {
+				log->error(name, "%s: connection id %u, expected %u", caseName.c_str(), connection.getSendConnectionId(), connectionId);
+				success = false;
+			}
+
+			// received packet takes slab of locally configured size,
+			// so window of received indices does not grow when remote side proposed smaller packets
+			int maxCount = 2*server.udpMaxReceiveBufferSize/server.udpSendPacketSize;
+			server.stepWhile(100000);
+			int receiveBufferSize = connection.getUdpReceiveBufferSize();
+			Packet packet;
+			packet.encode(Packet::Data, maxCount + 2, "x", 1);
+			send(server, peer, addressTunnel, packet);
+			server.stepWhile(100000);
+			if (connection.getUdpReceiveBufferSize() != receiveBufferSize) {
+				log->error(name, "%s: packet far ahead of receive window was accepted", caseName.c_str());
+				success = false;
+			}
+			packet.encode(Packet::Data, maxCount, "x", 1);
+			send(server, peer, addressTunnel, packet);
+			server.stepWhile(100000);
+			if (connection.getUdpReceiveBufferSize() == receiveBufferSize) {
+				log->error(name, "%s: packet inside receive window was rejected", caseName.c_str());
+				success = false;
+			}
+		}
+	}
+
+	server.end();
+}
+
+// remote side changes address (NAT rebinding), late duplicate
+// from previous address should not turn connection back,
+// and address should not change too often
+void TestHandshake::testMigration() {
+	Address addressTunnel("127.0.0.1:2240");
+	Address addressServer("127.0.0.1:2241");
+	Address addressPeerA("127.0.0.1:2242");
+	Address addressPeerB("127.0.0.1:2243");
+	unsigned int connectionId = 0x4321;
+
+	Server server(name + "(server)");
+	server.udpAddressChangeUs = 0;
+	server.createUdpListener(addressTunnel, addressServer);
+	server.begin();
+
+	{
+		SimpleTcpServer simpleTcpServer(
+			server.socketGroup,
+			server.eventManager,
+			name + "(simpleTcpServer)",
+			addressServer );
+
+		Socket peerA(server.socketGroup, name + "(peerA)", Socket::UDP);
+		peerA.bind(addressPeerA);
+		Socket peerB(server.socketGroup, name + "(peerB)", Socket::UDP);
+		peerB.bind(addressPeerB);
+
+		Packet packet;
+		packet.encodeHello(0, Packet::Capabilities, server.udpSendPacketSize, connectionId);
+		send(server, peerA, addressTunnel, packet);
+		server.stepWhile(100000);
+
+		const Connection *connection = server.connections.empty() ? NULL : *server.connections.begin();
+		if (!connection || connection->getSendConnectionId() != connectionId) {
+			log->error(name, "migration: connection id was not negotiated");
+			success = false;
+		} else {
+			Packet data1;
+			data1.encode(Packet::Data, 1, "1", 1, connectionId);
+			send(server, peerA, addressTunnel, data1);
+			server.stepWhile(100000);
+
+			packet.encode(Packet::Data, 2, "2", 1, connectionId);
+			send(server, peerB, addressTunnel, packet);
+			server.stepWhile(100000);
+			if (connection->getUdpAddress() != addressPeerB) {
+				log->error(name, "migration: connection does not follow new address");
+				success = false;
+			}
+
+			send(server, peerA, addressTunnel, data1);
+			server.stepWhile(100000);
+			if (connection->getUdpAddress() != addressPeerB) {
+				log->error(name, "migration: duplicate from previous address changed address of connection");
+				success = false;
+			}
+
+			// change allowed once per second
+			server.udpAddressChangeUs = 1000000;
+			packet.encode(Packet::Data, 3, "3", 1, connectionId);
+			send(server, peerA, addressTunnel, packet);
+			server.stepWhile(100000);
+			packet.encode(Packet::Data, 4, "4", 1, connectionId);
+			send(server, peerB, addressTunnel, packet);
+			server.stepWhile(100000);
+			if (connection->getUdpAddress() != addressPeerA) {
+				log->error(name, "migration: address of connection changed too often");
+				success = false;
+			}
+		}
+	}
+
+	server.end();
+}
+
+void TestHandshake::run() {
+	Packet hello;
+
+	hello.encodeHello(0, Packet::Capabilities, 512, 0x1234);
+	testHello("negotiation", hello, 512, Packet::Capabilities, 0x1234);
+
+	hello.encodeHello(0, Packet::Capabilities, 1, 0);
+	testHello("minimal packet size", hello, Packet::MinPacketSize, Packet::Capabilities, 0);
+
+	// hello without payload from peer of protocol version 0
+	hello.encode(Packet::Hello, 0);
+	testHello("old peer", hello, 0, 0, 0);
+
+	testMigration();
+}
@@ -0,0 +1,39 @@
+/*
+    ......... 2016 Ivan Mahonin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _TESTHANDSHAKE_H_
+#define _TESTHANDSHAKE_H_
+
+#include "test.h"
+
+
+class TestHandshake: public Test {
+public:
+	explicit TestHandshake(Log &log): Test("handshake", log) { }
+protected:
+	static void send(Server &server, Socket &socket, const Address &address, const Packet &packet);
+	void testHello(
+		const std::string &caseName,
+		const Packet &hello,
+		int packetSize,
+		unsigned int capabilities,
+		unsigned int connectionId );
+	void testMigration();
+	void run();
+};
+
+#endif
@@ -0,0 +1,76 @@
+/*
+    ......... 2016 Ivan Mahonin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <map>
+
+#include "../address.h"
+#include "../hashmap.h"
+
+#include "random.h"
+#include "testhashmap.h"
+
+
+void TestHashMap::run() {
+	unsigned int seed = randomSeedByTime();
+
+	std::vector<Address> addresses(4096);
+	for(int i = 0; i < (int)addresses.size(); ++i)
+		addresses[i].fromString(Log::strprintf("10.%d.%d.%d:%d",
+			random(seed)%256, random(seed)%256, random(seed)%256, 1024 + random(seed)%60000 ));
+
+	// compare with std::map under random inserts and erases
+	HashMap<Address, int> hashMap;
+	std::map<Address, int> map;
+	for(int i = 0; i < 200000; ++i) {
+		const Address &address = addresses[random(seed)%addresses.size()];
+		if (random(seed)%3) {
+			hashMap.insert(address) = i;
+			map[address] = i;
+		} else {
+			hashMap.erase(address);
+			map.erase(address);
+		}
+	}
+	if (hashMap.getCount() != (int)map.size()) {
+		log->error(name, "wrong count %d, expected %d", hashMap.getCount(), (int)map.size());
+		success = false;
+	}
+	for(int i = 0; i < (int)addresses.size(); ++i) {
+		std::map<Address, int>::const_iterator j = map.find(addresses[i]);
+		const int *value = hashMap.get(addresses[i]);
+		if ((j == map.end()) != !value || (value && *value != j->second)) {
+			log->error(name, "wrong item for %s", addresses[i].toString().c_str());
+			success = false;
+			break;
+		}
+	}
+
+	// measure lookups, which are done for each received datagram
+	for(int k = 0; k < 2; ++k) {
+		long long count = 0;
+		long long found = 0;
+		long long beginUs = Platform::nowUs();
+		long long durationUs = 0;
+		while(durationUs < 200000) {
+			for(int i = 0; i < (int)addresses.size(); ++i)
+				if (k ? map.find(addresses[i]) != map.end() : hashMap.get(addresses[i]) != NULL) ++found;
+			count += addresses.size();
+			durationUs = Platform::nowUs() - beginUs;
+		}
+		log->info(name, "%s, %d items: %f lookups per microsecond (found %lld)",
+			k ? "std::map" : "hashmap", (int)map.size(), (double)count/(double)durationUs, found );
+	}
+}
@@ -18,7 +18,12 @@
 #include "testlauncher.h"
 #include "test.h"
 #include "testbenchmark.h"
+#include "testcrc32.h"
+#include "testhandshake.h"
+#include "testhashmap.h"
 #include "testsimpletcp.h"
+#include "testsocketbackend.h"
+#include "teststeering.h"
 #include "testtransfer.h"
 
 bool TestLauncher::launchAll(Log &log, const Address &tcpRemoteAddress, const Address &udpRemoteAddress) {
@@ -27,17 +32,23 @@ bool TestLauncher::launchAll(Log &log, const Address &tcpRemoteAddress, const Ad
 	log.info(name, "begin");
 
 
+	success &= TestCrc32(log).launch();
+	success &= TestHashMap(log).launch();
 	success &= TestSimpleTcp(log).launch();
 	success &= TestTransfer(log).launch();
+	success &= TestHandshake(log).launch();
+	success &= TestSocketBackend(log, Socket::Group::BackendPoll).launch();
+	success &= TestSocketBackend(log, Socket::Group::BackendUring).launch();
+	success &= TestSteering(log).launch();
 	success &= TestBenchmark(log,  true, false).launch();
 	success &= TestBenchmark(log, false, false).launch();
 	success &= TestBenchmark(log,  true,  true).launch();
 	success &= TestBenchmark(log, false,  true).launch();
-	if (!tcpRemoteAddress.data.empty()) {
+	if (!tcpRemoteAddress.empty()) {
 		success &= TestBenchmark(log,  true, false, tcpRemoteAddress).launch();
 		success &= TestBenchmark(log, false, false, tcpRemoteAddress).launch();
 	}
-	if (!udpRemoteAddress.data.empty()) {
+	if (!udpRemoteAddress.empty()) {
 		success &= TestBenchmark(log,  true, true, udpRemoteAddress).launch();
 		success &= TestBenchmark(log, false, true, udpRemoteAddress).launch();
 	}
@@ -0,0 +1,76 @@
+/*
+    ......... 2016 Ivan Mahonin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "testsocketbackend.h"
+
+
+void TestSocketBackend::run() {
+	const int batch = 32;
+	const int size = 1033;
+	long long durationUs = 2000000;
+
+	Socket::Group group(name + "(socketGroup)", *log);
+	if (!group.setBackend(backend)) {
+		log->warning(name, "backend is not supported, skip");
+		return;
+	}
+
+	Address addressReceiver("127.0.0.1:2250");
+	Address addressSender("127.0.0.1:2251");
+	Socket receiver(group, name + "(receiver)", Socket::UDP);
+	Socket sender(group, name + "(sender)", Socket::UDP);
+	receiver.bind(addressReceiver);
+	sender.bind(addressSender);
+
+	Buffer buffer(batch*size);
+	const void *sendData[batch];
+	void *receiveData[batch];
+	int sizes[batch];
+	int resultSizes[batch];
+	const Address *sendAddresses[batch];
+	Address receiveAddresses[batch];
+	for(int i = 0; i < batch; ++i) {
+		sendData[i] = receiveData[i] = &buffer[size*i];
+		sizes[i] = size;
+		sendAddresses[i] = &addressReceiver;
+	}
+
+	long long sent = 0;
+	long long received = 0;
+	clock_t beginClock = clock();
+	long long endUs = Platform::nowUs() + durationUs;
+	while(Platform::nowUs() < endUs) {
+		if (sender.sourceWrite.getReady())
+			sent += sender.writeto(sendData, sizes, sendAddresses, resultSizes, batch, name);
+		while(receiver.sourceRead.getReady())
+			received += receiver.readfrom(receiveData, sizes, NULL, 0, receiveAddresses, resultSizes, batch);
+		group.poll(sender.sourceWrite.getReady() ? 0 : 1000);
+	}
+	double cpuSeconds = (double)(clock() - beginClock)/(double)CLOCKS_PER_SEC;
+
+	if (received <= 0) {
+		log->error(name, "no one datagram received, sent %lld", sent);
+		success = false;
+		return;
+	}
+
+	log->info(name, "sent %lld, received %lld datagrams of %d bytes in %f seconds, cpu %f seconds",
+		sent, received, size, 0.000001*(double)durationUs, cpuSeconds );
+	log->info(name, "received %f datagrams per second, %f per cpu-second",
+		1000000.0*(double)received/(double)durationUs,
+		cpuSeconds > 0.0 ? (double)received/cpuSeconds : 0.0 );
+}
@@ -0,0 +1,37 @@
+/*
+    ......... 2016 Ivan Mahonin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _TESTSOCKETBACKEND_H_
+#define _TESTSOCKETBACKEND_H_
+
+#include "test.h"
+
+
+class TestSocketBackend: public Test {
+private:
+	Socket::Group::Backend backend;
+public:
+	explicit TestSocketBackend(Log &log, Socket::Group::Backend backend):
+		Test( std::string("socketBackend")
+			+ (backend == Socket::Group::BackendUring ? "(uring)" : "(poll)"),
+			log ),
+		backend(backend) { }
+protected:
+	void run();
+};
+
+#endif
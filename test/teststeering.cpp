@@ -0,0 +1,101 @@
+/*
+    ......... 2016 Ivan Mahonin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "teststeering.h"
+
+
+// sockets share port, every datagram should come to socket
+// which Socket::getSteeringIndex predicts, by address of sender
+// or by connection id of tagged packet
+void TestSteering::run() {
+	const int count = 4;
+	const int sendersCount = 8;
+
+	Socket::Group group(name + "(socketGroup)", *log);
+	Address addressShared("127.0.0.1:2255");
+
+	std::vector<Socket*> receivers;
+	std::vector<Socket*> senders;
+	bool supported = true;
+	for(int i = 0; i < count && supported; ++i) {
+		receivers.push_back(new Socket(group, Log::strprintf("%s(receiver%d)", name.c_str(), i), Socket::UDP));
+		supported = receivers.back()->setReusePort(true);
+		receivers.back()->bind(addressShared);
+	}
+	for(int i = 0; i < count && supported; ++i)
+		supported = receivers[i]->setReusePortSteering(count);
+
+	if (supported) {
+		for(int i = 0; i < sendersCount; ++i) {
+			senders.push_back(new Socket(group, Log::strprintf("%s(sender%d)", name.c_str(), i), Socket::UDP));
+			senders.back()->bind(Address(Log::strprintf("127.0.0.1:%d", 2256 + i)));
+		}
+
+		// each sender sends untagged packet and tagged one
+		int sent = 0;
+		for(int i = 0; i < sendersCount; ++i) {
+			Packet packet;
+			for(int j = 0; j < 2; ++j) {
+				packet.encode(Packet::Data, i, NULL, 0, j ? 0x9E3779B9u*(unsigned int)(i + 1) : 0);
+				long long endUs = Platform::nowUs() + 1000000;
+				while(Platform::nowUs() < endUs && !senders[i]->sourceWrite.getReady())
+					group.poll(1000);
+				if (senders[i]->writeto(packet.getRawData(), addressShared, packet.getRawSize(), name) > 0)
+					++sent;
+			}
+		}
+
+		int received = 0;
+		long long endUs = Platform::nowUs() + 1000000;
+		while(Platform::nowUs() < endUs && received < sent) {
+			for(int i = 0; i < count; ++i) {
+				while(receivers[i]->sourceRead.getReady()) {
+					Packet packet;
+					packet.setRawSize(Packet::HeaderSize + Packet::ConnectionIdSize);
+					Address address;
+					int size = receivers[i]->readfrom(packet.getRawData(), address, packet.getRawSize());
+					if (size <= 0) break;
+					packet.setRawSize(size);
+					++received;
+
+					int expected = packet.hasConnectionId()
+					             ? Socket::getSteeringIndex(packet.getConnectionId(), count)
+					             : Socket::getSteeringIndex(address, count);
+					if (i != expected) {
+						log->error(name, "%s packet #%d from %s came to socket %d, expected %d",
+							packet.hasConnectionId() ? "tagged" : "untagged",
+							packet.getIndex(), address.toString().c_str(), i, expected );
+						success = false;
+					}
+				}
+			}
+			group.poll(1000);
+		}
+
+		if (received < sent) {
+			log->error(name, "received %d of %d packets", received, sent);
+			success = false;
+		}
+	} else {
+		log->warning(name, "steering of shared port is not supported, skip");
+	}
+
+	for(std::vector<Socket*>::iterator i = senders.begin(); i != senders.end(); ++i)
+		delete *i;
+	for(std::vector<Socket*>::iterator i = receivers.begin(); i != receivers.end(); ++i)
+		delete *i;
+}
@@ -0,0 +1,99 @@
+/*
+    ......... 2016 Ivan Mahonin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <cstddef>
+
+#include <linux/io_uring.h>
+
+
+// minimal io_uring made over raw system calls (linux only)
+class Uring {
+public:
+	struct Completion {
+		unsigned long long userData;
+		int result;
+		unsigned int flags;
+		Completion(): userData(), result(), flags() { }
+	};
+
+private:
+	int fd;
+	unsigned int features;
+
+	void *sqRing;
+	size_t sqRingSize;
+	void *cqRing;
+	size_t cqRingSize;
+	io_uring_sqe *sqes;
+	size_t sqesSize;
+
+	unsigned int *sqHead;
+	unsigned int *sqTail;
+	unsigned int *sqArray;
+	unsigned int sqMask;
+	unsigned int sqEntries;
+	unsigned int sqLocalTail;
+	unsigned int sqSubmitted;
+
+	unsigned int *cqHead;
+	unsigned int *cqTail;
+	unsigned int cqMask;
+	io_uring_cqe *cqes;
+
+	// provided buffers, kernel picks one of them for each received message
+	io_uring_buf_ring *bufRing;
+	size_t bufRingSize;
+	char *buffers;
+	int bufferSize;
+	int bufferCount;
+	int bufferGroup;
+	int buffersFree;
+	unsigned short bufTail;
+
+	Uring(const Uring&);
+	Uring& operator=(const Uring&);
+
+public:
+	Uring();
+	~Uring();
+
+	// returns zero or error number
+	int open(unsigned int entries);
+	int openBuffers(int group, int size, int count);
+	void close();
+
+	bool isOpened() const { return fd >= 0; }
+	bool hasFeature(unsigned int feature) const { return features & feature; }
+
+	// returns cleared submission entry, submits queued entries when queue is full
+	io_uring_sqe* prepare();
+	// submits queued entries and waits for any completion at most timeoutUs,
+	// returns zero or error number
+	int enter(long long timeoutUs);
+	bool pop(Completion &completion);
+
+	int getBufferGroup() const { return bufferGroup; }
+	int getBufferSize() const { return bufferSize; }
+	int getBuffersFree() const { return buffersFree; }
+	char* getBuffer(int id) const { return buffers + (size_t)id*bufferSize; }
+	void recycleBuffer(int id);
+};
+
+#endif
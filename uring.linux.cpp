@@ -0,0 +1,220 @@
+/*
+    ......... 2016 Ivan Mahonin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+
+Uring::Uring():
+	fd(-1),
+	features(),
+	sqRing(MAP_FAILED),
+	sqRingSize(),
+	cqRing(MAP_FAILED),
+	cqRingSize(),
+	sqes((io_uring_sqe*)MAP_FAILED),
+	sqesSize(),
+	sqHead(),
+	sqTail(),
+	sqArray(),
+	sqMask(),
+	sqEntries(),
+	sqLocalTail(),
+	sqSubmitted(),
+	cqHead(),
+	cqTail(),
+	cqMask(),
+	cqes(),
+	bufRing((io_uring_buf_ring*)MAP_FAILED),
+	bufRingSize(),
+	buffers(),
+	bufferSize(),
+	bufferCount(),
+	bufferGroup(),
+	buffersFree(),
+	bufTail()
+{ }
+
+Uring::~Uring() { close(); }
+
+int Uring::open(unsigned int entries) {
+	close();
+
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = 4*entries;
+	fd = (int)::syscall(__NR_io_uring_setup, entries, &params);
+	if (fd < 0) { fd = -1; return errno; }
+	features = params.features;
+
+	sqRingSize = params.sq_off.array + params.sq_entries*sizeof(unsigned int);
+	cqRingSize = params.cq_off.cqes + params.cq_entries*sizeof(io_uring_cqe);
+	if (features & IORING_FEAT_SINGLE_MMAP) {
+		if (sqRingSize < cqRingSize) sqRingSize = cqRingSize;
+		cqRingSize = sqRingSize;
+	}
+
+	sqRing = ::mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sqRing == MAP_FAILED) { int e = errno; close(); return e; }
+	if (features & IORING_FEAT_SINGLE_MMAP) {
+		cqRing = sqRing;
+	} else {
+		cqRing = ::mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cqRing == MAP_FAILED) { int e = errno; close(); return e; }
+	}
+	sqesSize = params.sq_entries*sizeof(io_uring_sqe);
+	sqes = (io_uring_sqe*)::mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) { int e = errno; close(); return e; }
+
+	char *sq = (char*)sqRing;
+	sqHead    = (unsigned int*)(sq + params.sq_off.head);
+	sqTail    = (unsigned int*)(sq + params.sq_off.tail);
+	sqArray   = (unsigned int*)(sq + params.sq_off.array);
+	sqMask    = *(unsigned int*)(sq + params.sq_off.ring_mask);
+	sqEntries = *(unsigned int*)(sq + params.sq_off.ring_entries);
+	sqLocalTail = sqSubmitted = *sqTail;
+
+	char *cq = (char*)cqRing;
+	cqHead = (unsigned int*)(cq + params.cq_off.head);
+	cqTail = (unsigned int*)(cq + params.cq_off.tail);
+	cqMask = *(unsigned int*)(cq + params.cq_off.ring_mask);
+	cqes   = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+	// entries of submission queue maps to entries of array one-to-one
+	for(unsigned int i = 0; i < sqEntries; ++i)
+		sqArray[i] = i;
+	return 0;
+}
+
+int Uring::openBuffers(int group, int size, int count) {
+	if (fd < 0) return EBADF;
+	if (count <= 0 || count > 32768 || (count & (count - 1)) || size <= 0) return EINVAL;
+
+	bufRingSize = count*sizeof(io_uring_buf);
+	bufRing = (io_uring_buf_ring*)::mmap(NULL, bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (bufRing == MAP_FAILED) return errno;
+
+	io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long long)bufRing;
+	reg.ring_entries = count;
+	reg.bgid = group;
+	if (::syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg, 1)) {
+		int e = errno;
+		::munmap(bufRing, bufRingSize);
+		bufRing = (io_uring_buf_ring*)MAP_FAILED;
+		return e;
+	}
+
+	buffers = new char[(size_t)size*count];
+	bufferSize = size;
+	bufferCount = count;
+	bufferGroup = group;
+	bufTail = 0;
+	for(int i = 0; i < count; ++i)
+		recycleBuffer(i);
+	return 0;
+}
+
+void Uring::close() {
+	if (fd >= 0) ::close(fd);
+	if (bufRing != MAP_FAILED) ::munmap(bufRing, bufRingSize);
+	if (sqes != MAP_FAILED) ::munmap(sqes, sqesSize);
+	if (cqRing != MAP_FAILED && cqRing != sqRing) ::munmap(cqRing, cqRingSize);
+	if (sqRing != MAP_FAILED) ::munmap(sqRing, sqRingSize);
+	delete[] buffers;
+
+	fd = -1;
+	features = 0;
+	sqRing = cqRing = MAP_FAILED;
+	sqes = (io_uring_sqe*)MAP_FAILED;
+	bufRing = (io_uring_buf_ring*)MAP_FAILED;
+	buffers = NULL;
+	bufferSize = bufferCount = bufferGroup = buffersFree = 0;
+}
+
+io_uring_sqe* Uring::prepare() {
+	if (fd < 0) return NULL;
+	if (sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+		enter(0);
+		if (sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+			return NULL;
+	}
+	io_uring_sqe *sqe = &sqes[sqLocalTail++ & sqMask];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+int Uring::enter(long long timeoutUs) {
+	if (fd < 0) return EBADF;
+
+	__atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+	unsigned int toSubmit = sqLocalTail - sqSubmitted;
+
+	unsigned int flags = 0;
+	unsigned int waitCount = 0;
+	timespec ts;
+	io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof(arg));
+	if (timeoutUs > 0 && __atomic_load_n(cqTail, __ATOMIC_ACQUIRE) == *cqHead) {
+		ts.tv_sec = timeoutUs/1000000;
+		ts.tv_nsec = timeoutUs%1000000*1000;
+		arg.sigmask_sz = _NSIG/8;
+		arg.ts = (unsigned long long)&ts;
+		flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+		waitCount = 1;
+	}
+	if (!toSubmit && !waitCount) return 0;
+
+	int result = (int)::syscall(__NR_io_uring_enter, fd, toSubmit, waitCount, flags, waitCount ? &arg : NULL, sizeof(arg));
+	if (result < 0) return errno == ETIME ? 0 : errno;
+	sqSubmitted += result;
+	return 0;
+}
+
+bool Uring::pop(Completion &completion) {
+	if (fd < 0) return false;
+	unsigned int head = *cqHead;
+	if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) return false;
+	const io_uring_cqe &cqe = cqes[head & cqMask];
+	completion.userData = cqe.user_data;
+	completion.result = cqe.res;
+	completion.flags = cqe.flags;
+	if ((cqe.flags & IORING_CQE_F_BUFFER) && bufferCount) --buffersFree;
+	__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+void Uring::recycleBuffer(int id) {
+	// ring entries starts from ring itself (tail overlaps reserved field of first entry),
+	// do not use flexible array member of header, c++ may place it with offset
+	io_uring_buf &buf = ((io_uring_buf*)bufRing)[bufTail & (bufferCount - 1)];
+	buf.addr = (unsigned long long)getBuffer(id);
+	buf.len = bufferSize;
+	buf.bid = id;
+	++bufTail;
+	__atomic_store_n(&bufRing->tail, bufTail, __ATOMIC_RELEASE);
+	++buffersFree;
+}
@@ -0,0 +1,139 @@
+/*
+    ......... 2016 Ivan Mahonin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _WINDOW_H_
+#define _WINDOW_H_
+
+#include <cstddef>
+
+#include <utility>
+#include <vector>
+
+
+// circular buffer of items indexed by sequence number,
+// item with index i stored at slot (i mod capacity),
+// capacity is power of two and grows when range [begin, end) not fits
+template<typename T>
+class Window {
+private:
+	struct Slot {
+		bool used;
+		T item;
+		Slot(): used() { }
+	};
+
+	std::vector<Slot> slots;
+	int mask;
+	int beginIndex;
+	int endIndex;
+	int count;
+
+	Slot& slot(int index) { return slots[index & mask]; }
+	const Slot& slot(int index) const { return slots[index & mask]; }
+
+	void reserve(int size) {
+		if (size <= (int)slots.size()) return;
+		int capacity = (int)slots.size();
+		while(capacity < size) capacity *= 2;
+		std::vector<Slot> newSlots(capacity);
+		for(int i = beginIndex; i < endIndex; ++i) {
+			Slot &s = slot(i);
+			if (s.used) {
+				Slot &n = newSlots[i & (capacity - 1)];
+				n.used = true;
+				std::swap(n.item, s.item);
+			}
+		}
+		slots.swap(newSlots);
+		mask = capacity - 1;
+	}
+
+public:
+	explicit Window(int capacity = 16):
+		mask(), beginIndex(), endIndex(), count()
+	{
+		int size = 1;
+		while(size < capacity) size *= 2;
+		slots.resize(size);
+		mask = size - 1;
+	}
+
+	int getBegin() const { return beginIndex; }
+	int getEnd() const { return endIndex; }
+	int getCount() const { return count; }
+	int getCapacity() const { return (int)slots.size(); }
+	bool empty() const { return count <= 0; }
+
+	T* get(int index) {
+		if (index < beginIndex || index >= endIndex) return NULL;
+		Slot &s = slot(index);
+		return s.used ? &s.item : NULL;
+	}
+
+	const T* get(int index) const {
+		if (index < beginIndex || index >= endIndex) return NULL;
+		const Slot &s = slot(index);
+		return s.used ? &s.item : NULL;
+	}
+
+	T& insert(int index) {
+		if (empty()) {
+			beginIndex = endIndex = index;
+		} else
+		if (index < beginIndex) {
+			reserve(endIndex - index);
+			beginIndex = index;
+		}
+		if (index >= endIndex) {
+			reserve(index + 1 - beginIndex);
+			endIndex = index + 1;
+		}
+		Slot &s = slot(index);
+		if (!s.used) {
+			s.used = true;
+			++count;
+		}
+		return s.item;
+	}
+
+	void erase(int index) {
+		if (index < beginIndex || index >= endIndex) return;
+		Slot &s = slot(index);
+		if (!s.used) return;
+		s.used = false;
+		s.item = T();
+		if (--count <= 0) { beginIndex = endIndex; return; }
+		while(!slot(beginIndex).used) ++beginIndex;
+		while(!slot(endIndex - 1).used) --endIndex;
+	}
+
+	void eraseBefore(int index)
+		{ while(!empty() && beginIndex < index) erase(beginIndex); }
+
+	void clear() {
+		for(int i = beginIndex; i < endIndex; ++i)
+			if (slot(i).used) { slot(i).used = false; slot(i).item = T(); }
+		beginIndex = endIndex = count = 0;
+	}
+
+	T& push() { return insert(endIndex); }
+	T& front() { return slot(beginIndex).item; }
+	const T& front() const { return slot(beginIndex).item; }
+	void pop() { erase(beginIndex); }
+};
+
+#endif